@@ -0,0 +1,269 @@
+#include "../include/SurfacePlotter.h"
+#include "../include/AllocationCounter.h"
+#include "../include/VectorMath.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#define DEFAULT_INTERVAL 0.02f
+#define DEFAULT_ITERATIONS 10
+#define ROW_GRID_SIZE 2000
+#define RADIAL_FUNCTION "sin(sqrt(x^2 + y^2) - t)"
+#define PARABOLOID_FUNCTION "((x/1.5)^2 + (y/1.5)^2) * 0.3"
+#define PRODUCT_FUNCTION "sin(x + t) * exp(-abs(y) / 4)"
+#define PERIODIC_FUNCTION "sin(x * y / 8 - t)" // neither radial nor separable, so the cache plays it back
+#define CACHE_KEYFRAMES 64 // animation cache budget of the benchmark, in frames
+#define SLOPE_STEP 1e-3f    // finite difference step of the separate normal pass
+
+enum SlopeMethod {
+    SLOPES_NONE,      // z only
+    SLOPES_SEPARATE,  // z, then its slopes by finite differences in a pass of their own
+    SLOPES_FUSED      // z with its slopes from the differentiated expression
+};
+
+// compiled equivalent of DEFAULT_FUNCTION
+static float sombrero(float x, float y, float t) {
+    return sin(t) * 8*sin(sqrt(pow(x, 2) + pow(y, 2))) / sqrt(pow(x, 2) + pow(y, 2));
+}
+
+// average milliseconds per generateSurfacePlot call, static functions are evaluated every time too
+static double timeSurfacePlot(SurfacePlotter& plotter, int iterations) {
+    plotter.generateSurfacePlot(0.0f); // warm up
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        plotter.invalidateVertices();
+        plotter.generateSurfacePlot(1.0f + i * 0.01f);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+// average milliseconds to evaluate a ROW_GRID_SIZE x ROW_GRID_SIZE grid, per vertex or per row
+static double timeExpression(const Expression& expression, bool batched, int iterations) {
+    std::vector<float> xs(ROW_GRID_SIZE), zs(ROW_GRID_SIZE);
+    for (int i = 0; i < ROW_GRID_SIZE; ++i)
+        xs[i] = -10.0f + 20.0f * i / (ROW_GRID_SIZE - 1);
+
+    volatile float sink = 0.0f;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (int row = 0; row < ROW_GRID_SIZE; ++row) {
+            float y = xs[row];
+            if (batched) {
+                expression.evaluateRow(xs.data(), y, 1.0f + i * 0.01f, zs.data(), ROW_GRID_SIZE);
+            }
+            else {
+                for (int col = 0; col < ROW_GRID_SIZE; ++col)
+                    zs[col] = expression.evaluate(xs[col], y, 1.0f + i * 0.01f);
+            }
+            sink = sink + zs[row];
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+// average milliseconds to evaluate z and its slopes on a ROW_GRID_SIZE x ROW_GRID_SIZE grid, per row
+static double timeSlopes(const Expression& expression, const Expression& gradient, SlopeMethod method, int iterations) {
+    std::vector<float> xs(ROW_GRID_SIZE), shifted(ROW_GRID_SIZE), zs(ROW_GRID_SIZE), dzdx(ROW_GRID_SIZE), dzdy(ROW_GRID_SIZE);
+    for (int i = 0; i < ROW_GRID_SIZE; ++i) {
+        xs[i] = -10.0f + 20.0f * i / (ROW_GRID_SIZE - 1);
+        shifted[i] = xs[i] + SLOPE_STEP;
+    }
+
+    volatile float sink = 0.0f;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        float t = 1.0f + i * 0.01f;
+        for (int row = 0; row < ROW_GRID_SIZE; ++row) {
+            float y = xs[row];
+            if (method == SLOPES_FUSED) {
+                gradient.evaluateGradientRow(xs.data(), y, t, zs.data(), dzdx.data(), dzdy.data(), ROW_GRID_SIZE);
+            }
+            else {
+                expression.evaluateRow(xs.data(), y, t, zs.data(), ROW_GRID_SIZE);
+                if (method == SLOPES_SEPARATE) {
+                    expression.evaluateRow(shifted.data(), y, t, dzdx.data(), ROW_GRID_SIZE);
+                    expression.evaluateRow(xs.data(), y + SLOPE_STEP, t, dzdy.data(), ROW_GRID_SIZE);
+                    for (int col = 0; col < ROW_GRID_SIZE; ++col) {
+                        dzdx[col] = (dzdx[col] - zs[col]) / SLOPE_STEP;
+                        dzdy[col] = (dzdy[col] - zs[col]) / SLOPE_STEP;
+                    }
+                }
+            }
+            sink = sink + zs[row] + dzdx[row] + dzdy[row];
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+// symmetric fast path of function against exact evaluation, on the same frame
+static void compareSymmetry(SurfacePlotter& plotter, const char* function, int iterations) {
+    static const char* symmetryNames[] = {"none", "radial", "separable sum", "separable product"};
+    plotter.setFunction(function);
+
+    plotter.setExact(true);
+    double exact = timeSurfacePlot(plotter, iterations);
+    size_t exactEvaluations = plotter.getNumEvaluations();
+    std::vector<float> exactVertices(plotter.getVertices(), plotter.getVertices() + plotter.getNumElements());
+    plotter.setExact(false);
+    double fast = timeSurfacePlot(plotter, iterations);
+
+    // error relative to the z range, NaN only matches NaN
+    float largestError = 0.0f;
+    for (size_t i = 2; i < exactVertices.size(); i += 3) {
+        float difference = std::fabs(exactVertices[i] - plotter.getVertices()[i]);
+        if (std::isnan(exactVertices[i]) != std::isnan(plotter.getVertices()[i]))
+            difference = INFINITY;
+        if (difference > largestError)
+            largestError = difference;
+    }
+
+    std::cout << function << " (" << symmetryNames[plotter.getSymmetry()] << (plotter.isTimeFactored() ? ", time factored" : "")
+              << ")" << std::endl;
+    std::cout << "  exact:     " << exact << " ms/frame, " << exactEvaluations << " evaluations" << std::endl;
+    std::cout << "  fast path: " << fast << " ms/frame, " << plotter.getNumEvaluations() << " evaluations ("
+              << exact / fast << "x faster, largest error " << largestError / plotter.getZRange() << " of the z range)" << std::endl;
+}
+
+// periodic function interpolated between cached keyframes against exact evaluation, on the same frame
+static void compareAnimationCache(SurfacePlotter& plotter, const char* function, int iterations) {
+    plotter.setFunction(function);
+
+    plotter.setExact(true);
+    double exact = timeSurfacePlot(plotter, iterations);
+    std::vector<float> exactVertices(plotter.getVertices(), plotter.getVertices() + plotter.getNumElements());
+    plotter.setExact(false);
+
+    // the cache fills one keyframe per frame until a level is within its tolerance
+    uint numFrames = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (!plotter.isCached() && numFrames < ANIMATION_MAX_KEYFRAMES)
+        plotter.generateSurfacePlot(++numFrames * 0.01f);
+    auto end = std::chrono::steady_clock::now();
+    double filling = std::chrono::duration<double, std::milli>(end - start).count() / numFrames;
+    std::cout << function << " (period " << plotter.getPeriod() << ")" << std::endl;
+    std::cout << "  exact:     " << exact << " ms/frame" << std::endl;
+    std::cout << "  filling:   " << filling << " ms/frame over " << numFrames << " frames" << std::endl;
+    if (!plotter.isCached()) {
+        std::cout << "  cache:     not within tolerance" << std::endl;
+        return;
+    }
+
+    double cached = timeSurfacePlot(plotter, iterations);
+    float largestError = 0.0f;
+    for (size_t i = 2; i < exactVertices.size(); i += 3)
+        largestError = std::max(largestError, std::fabs(exactVertices[i] - plotter.getVertices()[i]));
+
+    std::cout << "  cached:    " << cached << " ms/frame after " << numFrames << " frames, " << (plotter.getCacheSize() >> 20)
+              << " MB (" << exact / cached << "x faster, largest error " << largestError / plotter.getZRange() << " of the z range)"
+              << std::endl;
+}
+
+// usage: 3DSurfacePlotterBenchmark [grid interval] [iterations] [threads]
+int main(int argc, char** argv) {
+    float interval = (argc > 1) ? atof(argv[1]) : DEFAULT_INTERVAL;
+    int iterations = (argc > 2) ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    int numThreads = (argc > 3) ? atoi(argv[3]) : 0;
+
+    // symmetry fast paths are measured separately at the end
+    SurfacePlotter plotter;
+    plotter.setExact(true);
+    plotter.setNumThreads(1);
+    plotter.setGrid(-10.0f, 10.0f, -10.0f, 10.0f, interval);
+
+    plotter.setFunction(sombrero);
+    double compiled = timeSurfacePlot(plotter, iterations);
+
+    plotter.setFunction(DEFAULT_FUNCTION);
+    double interpreted = timeSurfacePlot(plotter, iterations);
+
+    uint numVertices = plotter.getNumElements() / 3;
+    std::cout << "function:    " << DEFAULT_FUNCTION << std::endl;
+    std::cout << "bytecode:    " << plotter.getExpression().getNumInstructions() << " instructions, "
+              << plotter.getExpression().getNumRegisters() << " registers" << std::endl;
+    std::cout << "grid:        " << numVertices << " vertices" << std::endl;
+    std::cout << "compiled:    " << compiled << " ms/frame" << std::endl;
+    std::cout << "interpreted: " << interpreted << " ms/frame (" << interpreted / compiled << "x)" << std::endl;
+
+    // thread scaling, every thread count must reproduce the single-threaded vertices exactly
+    plotter.setNumThreads(1);
+    double singleThreaded = timeSurfacePlot(plotter, iterations);
+    std::vector<float> reference(plotter.getVertices(), plotter.getVertices() + plotter.getNumElements());
+
+    plotter.setNumThreads(numThreads);
+    double multiThreaded = timeSurfacePlot(plotter, iterations);
+    bool identical = memcmp(reference.data(), plotter.getVertices(), reference.size() * sizeof(float)) == 0;
+
+    std::cout << "1 thread:    " << singleThreaded << " ms/frame" << std::endl;
+    std::cout << plotter.getNumThreads() << " threads:   " << multiThreaded << " ms/frame ("
+              << singleThreaded / multiThreaded << "x faster, " << (identical ? "bit-identical" : "MISMATCH") << ")" << std::endl;
+
+    // steady-state frames must reuse their buffers
+    size_t allocations = getAllocationCount();
+    timeSurfacePlot(plotter, iterations);
+    std::cout << "allocations: " << (getAllocationCount() - allocations) << " in " << iterations + 1
+              << " frames after warm-up (counted in debug builds only)" << std::endl;
+
+    // per-frame upload size of each vertex format
+    const char* formatNames[] = {"full", "float", "half"};
+    for (int format = VERTEX_FORMAT_FULL; format <= VERTEX_FORMAT_HALF_HEIGHT; ++format) {
+        plotter.setVertexFormat((VertexFormat)format);
+        double milliseconds = timeSurfacePlot(plotter, iterations);
+        std::cout << formatNames[format] << " vertices: " << plotter.getVertexDataSize() / 1024 << " KiB/frame, "
+                  << milliseconds << " ms/frame" << std::endl;
+    }
+    plotter.setVertexFormat(VERTEX_FORMAT_FULL);
+
+    double scalar = timeExpression(plotter.getExpression(), false, iterations);
+    double batched = timeExpression(plotter.getExpression(), true, iterations);
+    std::cout << std::endl << ROW_GRID_SIZE << "x" << ROW_GRID_SIZE << " grid, expression only" << std::endl;
+    std::cout << "scalar:      " << scalar << " ms/frame" << std::endl;
+    std::cout << "evaluateRow: " << batched << " ms/frame (" << getVectorMath().name << ", "
+              << scalar / batched << "x faster)" << std::endl;
+
+    // analytic normals: the derivatives share the subexpressions of z, so the fused pass costs less than
+    // evaluating z and then its slopes
+    Expression gradient;
+    plotter.getExpression().differentiate(gradient);
+    double zOnly = timeSlopes(plotter.getExpression(), gradient, SLOPES_NONE, iterations);
+    double separate = timeSlopes(plotter.getExpression(), gradient, SLOPES_SEPARATE, iterations);
+    double fused = timeSlopes(plotter.getExpression(), gradient, SLOPES_FUSED, iterations);
+    std::cout << std::endl << ROW_GRID_SIZE << "x" << ROW_GRID_SIZE << " grid, z and slopes" << std::endl;
+    std::cout << "bytecode:    " << gradient.getNumInstructions() << " instructions with slopes, "
+              << plotter.getExpression().getNumInstructions() << " without" << std::endl;
+    std::cout << "z only:      " << zOnly << " ms/frame" << std::endl;
+    std::cout << "separate:    " << separate << " ms/frame (z, then finite differences)" << std::endl;
+    std::cout << "fused:       " << fused << " ms/frame (" << separate / fused << "x faster than separate)" << std::endl;
+
+    double withoutNormals = timeSurfacePlot(plotter, iterations);
+    plotter.setNormals(true);
+    double withNormals = timeSurfacePlot(plotter, iterations);
+    plotter.setNormals(false);
+    std::cout << "surface:     " << withNormals << " ms/frame with normals, " << withoutNormals << " without ("
+              << plotter.getNumThreads() << " threads)" << std::endl;
+
+    // symmetric and time factored functions, filled from fewer evaluations against every grid point
+    plotter.setNumThreads(1);
+    plotter.setCacheBudget(0);
+    std::cout << std::endl << "symmetry, " << numVertices << " vertices, 1 thread" << std::endl;
+    compareSymmetry(plotter, DEFAULT_FUNCTION, iterations);
+    compareSymmetry(plotter, RADIAL_FUNCTION, iterations);
+    compareSymmetry(plotter, PARABOLOID_FUNCTION, iterations);
+    compareSymmetry(plotter, PRODUCT_FUNCTION, iterations);
+
+    // periodic functions played back from keyframes
+    plotter.setCacheBudget(CACHE_KEYFRAMES * numVertices * sizeof(float));
+    std::cout << std::endl << "animation cache, " << numVertices << " vertices, 1 thread" << std::endl;
+    compareAnimationCache(plotter, PERIODIC_FUNCTION, iterations);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef ALIGNEDBUFFER_H
+#define ALIGNEDBUFFER_H
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include "AllocationCounter.h"
+
+#define BUFFER_ALIGNMENT 64 // cache line, also satisfies AVX loads
+
+// growable array of trivially copyable elements with cache line aligned storage,
+// resizing within the current capacity never touches the heap
+template <class T>
+class AlignedBuffer {
+    private:
+        T* elements;
+        size_t count;
+        size_t allocated;
+
+    public:
+        AlignedBuffer() :
+            elements(NULL), count(0), allocated(0) {}
+
+        ~AlignedBuffer() {
+            free(this->elements);
+        }
+
+        AlignedBuffer(const AlignedBuffer&) = delete;
+        AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+        AlignedBuffer(AlignedBuffer&& other) noexcept :
+            elements(other.elements), count(other.count), allocated(other.allocated) {
+            other.elements = NULL;
+            other.count = 0;
+            other.allocated = 0;
+        }
+
+        AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+            std::swap(this->elements, other.elements);
+            std::swap(this->count, other.count);
+            std::swap(this->allocated, other.allocated);
+            return *this;
+        }
+
+        // grow capacity to at least n elements, contents are preserved
+        void reserve(size_t n) {
+            if (n <= this->allocated)
+                return;
+
+            void* memory;
+            if (posix_memalign(&memory, BUFFER_ALIGNMENT, n * sizeof(T)) != 0)
+                throw std::bad_alloc();
+            T* grown = static_cast<T*>(memory);
+            countAllocation();
+
+            if (this->count)
+                memcpy(grown, this->elements, this->count * sizeof(T));
+            free(this->elements);
+
+            this->elements = grown;
+            this->allocated = n;
+        }
+
+        // new elements are left uninitialized
+        void resize(size_t n) {
+            reserve(n);
+            this->count = n;
+        }
+
+        void clear(void) {
+            this->count = 0;
+        }
+
+        T* data(void) { return this->elements; }
+        const T* data(void) const { return this->elements; }
+        size_t size(void) const { return this->count; }
+        size_t capacity(void) const { return this->allocated; }
+        bool empty(void) const { return this->count == 0; }
+
+        T& operator[](size_t i) { return this->elements[i]; }
+        const T& operator[](size_t i) const { return this->elements[i]; }
+};
+
+#endif //ALIGNEDBUFFER_H
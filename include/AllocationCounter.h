@@ -0,0 +1,16 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+
+// debug builds replace the global operator new to count heap allocations, so hot paths
+// can assert that they allocate nothing; release builds always report 0
+size_t getAllocationCount(void);
+
+// allocations made by the calling thread only, unaffected by worker and encoder threads
+size_t getThreadAllocationCount(void);
+
+// records an allocation made outside operator new, e.g. by AlignedBuffer
+void countAllocation(void);
+
+#endif //ALLOCATIONCOUNTER_H
@@ -0,0 +1,60 @@
+#ifndef COMPUTEEVALUATOR_H
+#define COMPUTEEVALUATOR_H
+
+#include <glad/glad.h>
+#include <string>
+#include "AlignedBuffer.h"
+#include "Expression.h"
+#include "Shader.h"
+#include "SurfacePlotter.h"
+
+#define COMPUTE_GROUP_SIZE 256   // local_size_x in computeShader.cs
+#define COMPUTE_VERTEX_BINDING 1 // shader storage bindings in computeShader.cs
+#define COMPUTE_RANGE_BINDING 2  // also read by fragmentShader.fs
+#define COMPUTE_INVALID_BINDING 3
+#define COMPUTE_RANGE_FRAMES 3   // range and mask buffers in flight, each read back once its fence has passed
+#define COMPUTE_FENCE_TIMEOUT 1000000000 // nanoseconds per fence wait before retrying
+
+// evaluates a parsed function on the GPU: a compute shader generated from the expression writes the
+// vertices straight into a vertex buffer and reduces their z range into a shader storage buffer, which the
+// surface shaders read in the same frame and the CPU reads back a frame or more later, without waiting,
+// along with a bit mask of the non-finite samples
+class ComputeEvaluator {
+    private:
+        Shader program;
+        bool ready;
+        GLuint rangeBuffers[COMPUTE_RANGE_FRAMES];
+        GLuint invalidBuffers[COMPUTE_RANGE_FRAMES]; // a bit per vertex, set for non-finite samples
+        size_t invalidSizes[COMPUTE_RANGE_FRAMES];   // bytes allocated
+        size_t numVertices[COMPUTE_RANGE_FRAMES];    // of each dispatch
+        GLsync rangeFences[COMPUTE_RANGE_FRAMES]; // set while a range waits to be read back
+        uint rangeSlot; // range buffer of the newest dispatch
+        AlignedBuffer<uint32_t> invalidBits; // read back mask and its expansion
+        AlignedBuffer<uint8_t> validity;
+
+    public:
+        ComputeEvaluator();
+
+        // builds the compute program for expression, false if the context lacks compute shaders
+        // or the program fails to build, in which case the CPU keeps evaluating
+        bool init(const char* computePath, const Expression& expression);
+        bool isReady(void);
+        void destroy(void);
+
+        // writes the numX x numY grid at time into size bytes of buffer from offset, laid out as the surface
+        // plotter lays out format, its z range into a range buffer left bound to COMPUTE_RANGE_BINDING and
+        // the non-finite samples into a mask,
+        // offset must be a multiple of GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+        void evaluate(GLuint buffer, size_t offset, size_t size, VertexFormat format, glm::vec2 gridOrigin, float gridInterval,
+                      uint numX, uint numY, float time);
+
+        // binds the range buffer of the newest dispatch for the surface shaders
+        void bindRange(void);
+
+        // z range of the finite samples of the newest finished dispatch and the number of the others, with a
+        // validity byte per vertex as the surface plotter keeps it if there were any, NULL otherwise, valid until
+        // the next call, false if no dispatch finished since the last call, wait blocks until the newest has
+        bool readRange(float& zMin, float& zMax, size_t& numInvalid, const uint8_t*& valid, bool wait);
+};
+
+#endif //COMPUTEEVALUATOR_H
@@ -0,0 +1,169 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <cstdint>
+
+#define MAX_REGISTERS 64
+#define MAX_PERIOD_MULTIPLE 16 // largest multiple of the shortest period tried as the common period
+#define PERIOD_TOLERANCE 1e-4  // relative error accepted when multiples of two periods meet
+
+// bytecode operations, leaf operations only appear in the expression tree
+enum Opcode : uint8_t {
+    OP_CONST,
+    OP_X,
+    OP_Y,
+    OP_T,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_POW,
+    OP_NEG,
+    OP_ABS,
+    OP_SQRT,
+    OP_EXP,
+    OP_LOG,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ASIN,
+    OP_ACOS,
+    OP_ATAN,
+    OP_SINH,
+    OP_COSH,
+    OP_TANH,
+    NUM_OPCODES
+};
+
+// structure of a function in x and y that lets the grid be filled from fewer evaluations
+enum Symmetry {
+    SYMMETRY_NONE,
+    SYMMETRY_RADIAL,             // f(x, y, t) = f(sqrt(x^2 + y^2), 0, t)
+    SYMMETRY_SEPARABLE_SUM,      // f(x, y, t) = g(x, t) + h(y, t)
+    SYMMETRY_SEPARABLE_PRODUCT   // f(x, y, t) = g(x, t) * h(y, t)
+};
+
+// mathematical function of x, y and t parsed at runtime and compiled to register bytecode
+class Expression {
+    public:
+        // expression tree node, children are indices into the node pool
+        struct Node {
+            Opcode op;
+            int a;
+            int b;
+            float value; // OP_CONST only
+        };
+
+        // register bytecode instruction: regs[dst] = op(regs[a], regs[b])
+        struct Instruction {
+            Opcode op;
+            uint8_t dst;
+            uint8_t a;
+            uint8_t b;
+        };
+
+        Expression();
+
+        bool parse(const std::string& source); // returns false and sets error message on failure
+        float evaluate(float x, float y, float t) const;
+        void evaluateRow(const float* xs, float y, float t, float* zOut, size_t n) const;    // x varies along the batch
+        void evaluateColumn(float x, const float* ys, float t, float* zOut, size_t n) const; // y varies along the batch
+
+        // z with its partial derivatives dz/dx and dz/dy from the same pass, for expressions made by differentiate,
+        // NULL skips a derivative
+        void evaluateGradientRow(const float* xs, float y, float t, float* zOut, float* dzdxOut, float* dzdyOut, size_t n) const;
+        void evaluateGradientColumn(float x, const float* ys, float t, float* zOut, float* dzdxOut, float* dzdyOut, size_t n) const;
+
+        // GLSL definition of float f(float x, float y, float t), one statement per node of the expression tree
+        std::string toGLSL(void) const;
+
+        // found by inspecting the expression tree, SYMMETRY_NONE when in doubt
+        Symmetry getSymmetry(void) const;
+
+        // false for static surfaces, which are the same at every time
+        bool dependsOnTime(void) const;
+
+        // g(x, t) and h(y, t) of a separable expression, false for other symmetries
+        bool separate(Expression& g, Expression& h) const;
+
+        // a(t), g(x, y) and b(t) of an expression a(t) * g(x, y) + b(t) that depends on time and space,
+        // false for expressions of another form
+        bool factorTime(Expression& a, Expression& g, Expression& b) const;
+
+        // the same z with dz/dx and dz/dy as two more outputs, by forward mode automatic differentiation: every node
+        // gets a tangent node per variable in the same pool, so the derivatives share subexpressions with z,
+        // false if the result is too complex to compile
+        bool differentiate(Expression& gradient) const;
+        bool hasGradient(void) const;
+
+        // smallest period in t when t only appears in sin, cos and tan of c*t plus terms without t,
+        // 0 for expressions that are not periodic or do not depend on time
+        float findPeriod(void) const;
+
+        bool isValid(void) const;
+        const std::string& getSource(void) const;
+        const std::string& getError(void) const;
+        uint getNumInstructions(void) const;
+        uint getNumRegisters(void) const;
+
+    private:
+        std::string source;
+        std::string error;
+
+        // expression tree (hash-consed, so equal subexpressions share one node)
+        std::vector<Node> nodes;
+        std::map<std::tuple<int, int, int, uint32_t>, int> nodeLookup;
+        int root;
+        int gradientRoots[2]; // dz/dx and dz/dy of a differentiated expression, -1 otherwise
+        Symmetry symmetry;
+        bool timeDependent;
+
+        // compiled program, registers 0, 1, 2 hold x, y, t and constants are preloaded
+        std::vector<Instruction> code;
+        std::vector<float> initialRegisters;
+        uint numRegisters;
+        uint outputRegister;
+        uint gradientRegisters[2];
+
+        // parser state
+        size_t pos;
+
+        int parseSum(void);
+        int parseProduct(void);
+        int parseUnary(void);
+        int parsePower(void);
+        int parsePrimary(void);
+        void skipWhitespace(void);
+        int fail(const std::string& message);
+
+        // tree construction with constant folding and strength reduction
+        int addNode(Opcode op, int a = -1, int b = -1, float value = 0.0f);
+        int makeConstant(float value);
+        int makeUnary(Opcode op, int a);
+        int makeBinary(Opcode op, int a, int b);
+
+        std::vector<bool> findReachable(void) const; // nodes the outputs depend on
+        int differentiateNode(int i, Opcode variable, const std::vector<int>& tangents); // tangent of node i
+
+        // symmetry analysis, coefficients are 0 when the node has another form
+        float linearCoefficient(int i, Opcode variable) const;    // c of a node equal to c*variable
+        float quadraticCoefficient(int i, Opcode variable) const; // c of a node equal to c*variable^2
+        bool isSquaredRadius(int i) const;                        // c*(x^2 + y^2)
+        std::vector<uint8_t> findVariables(void) const;          // per node, 1 if it depends on x, 2 on y, 4 on t
+        void collectTerms(int i, float coefficient, std::vector<std::pair<int, float>>& terms) const;
+        void collectFactors(int i, float exponent, std::vector<std::pair<int, float>>& factors) const;
+        bool isSeparable(const std::vector<std::pair<int, float>>& operands) const;
+        int appendTerm(int sum, int node, float coefficient);   // sum + coefficient * node, -1 for an empty sum
+        int appendFactor(int product, int node, float exponent); // product * node^exponent, -1 for an empty product
+        Symmetry findSymmetry(void) const;
+        bool compile(void);
+
+        void evaluateBatch(uint varying, const float* values, float x, float y, float t, float* zOut, float* dzdxOut, float* dzdyOut,
+                           size_t n) const;
+};
+
+#endif //EXPRESSION_H
@@ -0,0 +1,99 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <glad/glad.h>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CAPTURE_BUFFERS 3      // pixel pack buffers in flight: frame N is read back while N+1 and N+2 render
+#define CAPTURE_QUEUE_FRAMES 8 // read back frames waiting for the encoder thread
+#define CAPTURE_FENCE_TIMEOUT 1000000000 // nanoseconds per fence wait before retrying
+#define SCREENSHOT_PATTERN "screenshot_%04d.png"
+
+// captures rendered frames without stalling the pipeline: glReadPixels copies each frame into a ring of
+// pixel pack buffers, a buffer is mapped only once its fence has passed, and the pixels are encoded to
+// images or a Y4M video stream on a worker thread
+class FrameCapture {
+    private:
+
+        // a frame on its way from the GPU to disk
+        struct CaptureJob {
+            std::vector<unsigned char> pixels; // RGBA as read back, packed to RGB by the encoder, bottom row first
+            int width, height;
+            bool toStream;    // append to the video stream
+            std::string path; // image file, empty for none
+        };
+
+        // GPU side, render thread only
+        GLuint packBuffers[CAPTURE_BUFFERS];
+        size_t packBufferSizes[CAPTURE_BUFFERS];
+        GLsync fences[CAPTURE_BUFFERS];
+        CaptureJob pending[CAPTURE_BUFFERS]; // what each buffer in flight becomes, pixels unused
+        uint firstPending, numPending;
+
+        // output
+        std::string pattern; // image file pattern with one %d, or a .y4m video path
+        bool stream;
+        int frameRate;
+        bool recording;
+        uint numFrames;
+        uint numScreenshots;
+        bool screenshotRequested;
+
+        // encoder thread, jobs[firstJob .. firstJob + numJobs) are queued
+        std::thread encoder;
+        std::mutex mutex;
+        std::condition_variable jobQueued;
+        std::condition_variable jobFinished;
+        CaptureJob jobs[CAPTURE_QUEUE_FRAMES];
+        uint firstJob, numJobs;
+        bool stopping;
+
+        // video stream, owned by the encoder thread
+        FILE* streamFile;
+        int streamWidth, streamHeight;
+        std::vector<unsigned char> yuv;
+
+        // statistics
+        uint readbackStalls; // frames that waited for a pixel pack buffer
+        uint encoderStalls;  // frames that waited for the encoder queue
+        uint failures;       // frames the encoder could not write, updated under the mutex
+
+        void startEncoder(void);
+        void stopEncoder(void);
+        void readBack(int width, int height);
+        void retire(bool wait); // hands finished readbacks to the encoder, waits for the oldest if wait
+        void encoderLoop(void);
+        bool encode(CaptureJob& job);
+        bool writeStreamFrame(const CaptureJob& job);
+
+    public:
+        FrameCapture();
+        ~FrameCapture();
+
+        FrameCapture(const FrameCapture&) = delete;
+        FrameCapture& operator=(const FrameCapture&) = delete;
+
+        // starts recording every frame to pattern, frameRate is written to Y4M streams,
+        // returns false if pattern is neither a .y4m path nor an image pattern with one %d
+        bool start(const std::string& pattern, int frameRate);
+        void setRecording(bool recording); // pauses or resumes, numbering and the stream continue
+        bool isRecording(void);
+        void requestScreenshot(void);      // the next frame also goes to screenshot_NNNN.png
+
+        // call once per frame after drawing, reads back the framebuffer bound to GL_READ_FRAMEBUFFER
+        // when recording or asked for a screenshot, and retires earlier readbacks
+        void captureFrame(int width, int height);
+
+        // true while frames are being read back or encoded, the encoder allocates
+        bool isActive(void);
+
+        // finishes every frame in flight, closes the stream and frees the GL buffers, needs the context
+        void stop(void);
+};
+
+#endif //FRAMECAPTURE_H
@@ -2,22 +2,73 @@
 #define GLPROGRAM_H
 
 #include <iostream>
+#include <string>
+#include <vector>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "Shader.h"
 #include "SurfacePlotter.h"
+#include "SurfaceProducer.h"
 #include "Camera.h"
+#include "HeadlessContext.h"
+#include "FrameCapture.h"
+#include "ComputeEvaluator.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #define MIN(a, b) ((a) < (b)) ? (a) : (b)
+#define WARMUP_FRAMES 3 // frames allowed to allocate before steady state
+#define STREAM_REGIONS 3 // vertex buffer regions in flight: CPU writing, GPU queued, GPU drawing
+#define STREAM_ALIGNMENT 256 // byte alignment of each region
+#define STREAM_FENCE_TIMEOUT 1000000000 // nanoseconds per fence wait before retrying
+#define TIMING_INTERVAL 2.0 // seconds between frame timing reports
+#define CAMERA_UBO_BINDING 0 // uniform buffer binding of the Camera block in the vertex shaders
+#define CAPTURE_FRAME_RATE 60 // frame rate of video captured from the window
+#define CAPTURE_DEFAULT_PATH "capture.y4m" // recorded when capturing is started without --capture
+#define COMPUTE_CHECK_TOLERANCE 1e-3 // largest difference between GPU and CPU samples, as a fraction of the z range
+#define GRID_LINE_WIDTH 1.0f      // pixels, of the grid lines drawn by the fragment shader
+#define GRID_LINE_WIDTH_STEP 0.5f // per '[' or ']' key press, also the narrowest width
+
+// how the surface is drawn, the filled styles draw triangle strips indexed into the same vertices as the wireframe
+enum SurfaceStyle {
+    STYLE_WIREFRAME,
+    STYLE_FILLED,
+    STYLE_FILLED_WIREFRAME, // filled, with the wireframe drawn over it
+    STYLE_FILLED_GRID       // filled, with anti-aliased grid lines drawn by the fragment shader in the same pass
+};
+
+// shading of surface fragments, matches shading in fragmentShader.fs
+enum SurfaceShading {
+    SHADING_NONE,    // colour gradient over z
+    SHADING_LIT,     // gradient lit by a directional light, for triangles
+    SHADING_OVERLAY, // darkened gradient, for the wireframe over a filled surface
+    SHADING_GRID     // lit, with grid lines from the fragment's grid coordinates
+};
+
+// parts of a frame measured by the frame timing report
+enum FramePhase {
+    PHASE_INPUT,
+    PHASE_GENERATE, // surface evaluation, or taking the newest frame from the producer thread
+    PHASE_UNIFORMS,
+    PHASE_DRAW,     // vertex upload and draw calls
+    PHASE_CAPTURE,  // queueing frame readbacks and handing finished ones to the encoder
+    PHASE_SWAP,
+    NUM_PHASES
+};
 
 class GLProgram {
     private:
         GLFWwindow* window;
 
+        // offscreen rendering into a framebuffer object, no window system involved
+        bool headless;
+        HeadlessContext headlessContext;
+
+        // frames read back through pixel pack buffers and written to disk by an encoder thread
+        FrameCapture frameCapture;
+
         float deltaTime, prevTime;
 
         struct color {
@@ -27,12 +78,99 @@ class GLProgram {
             float alpha = 1.0f;
         } clearColor;
 
-        Shader shader, whiteShader;
+        Shader shader, heightShader, whiteShader;
         SurfacePlotter surfacePlotter;
         uint surfacePlotVAO, surfacePlotVBO, surfacePlotEBO;
+
+        // surface frames come from the producer thread, or are generated in the render loop when not async
+        bool async;
+        SurfaceProducer surfaceProducer;
+        SurfaceFrame syncFrame;
+        VertexFormat vertexFormat; // requested format, frames switch over once generated with it
+        SurfaceStyle surfaceStyle; // filled styles are drawn once frames carry triangle strips
+        float gridLineWidth;       // pixels
+        uint drawnFrame;           // id of the frame on the GPU
+        bool surfacePlotUploaded;  // false when the vertex buffer must be refilled from the current frame
+        uint unsettledFrames;      // new frames left before steady state, restarted when buffers may grow
+
+        // frame phase timing, seconds accumulated since timingStart
+        bool timing;
+        double phaseTimes[NUM_PHASES];
+        uint timedFrames;
+        uint producedFrames; // new frames from the producer thread, whose generation time is producerTime
+        double producerTime;
+        double timingStart;
+
+        // redraw only on input while the surface is static, the render loop sleeps in glfwWaitEvents
+        bool onDemand;
+        bool isIdle(void); // nothing but input can change the next frame
+
+        // parsed functions evaluated by a compute shader straight into the vertex buffer, optionally
+        // compared with the CPU evaluation of every frame
+        bool compute;
+        bool computeCheck;
+        ComputeEvaluator computeEvaluator;
+        uint checkedFrames;
+        size_t checkMismatches; // samples differing by more than COMPUTE_CHECK_TOLERANCE
+        double checkMaxError;
+        std::vector<char> checkData; // vertices read back from the GPU
+
+        const SurfaceFrame& generateComputeFrame(float time);
+        void checkComputeFrame(GLuint buffer, size_t offset, float time);
+        bool reportComputeCheck(void); // false if any sample differed
+
+        void endPhase(FramePhase phase, double& phaseStart); // adds the time since phaseStart and restarts it
+        void reportTiming(const SurfaceFrame& frame, bool newFrame);
+
+        // persistently mapped vertex stream, the surface plotter writes each frame straight into
+        // the next region once the GPU has finished drawing from it, surfacePlotVBO is the fallback
+        bool streaming;
+        uint streamVBO;
+        char* streamMemory;
+        size_t streamRegionSize;
+        uint streamRegion;
+        GLsync streamFences[STREAM_REGIONS];
         uint cubeVAO, cubeVBO, cubeEBO;
 
+        // temporal interpolation of producer frames: the previous frame stays in its stream region as a
+        // second z stream and the vertex shaders blend from it to the latest frame, over the time
+        // between the two frames, so slow functions still move smoothly at the display rate
+        struct StreamedFrame {
+            bool valid; // region holds the frame, false once the region may have been reused
+            uint region;
+            VertexFormat format;
+            float time;
+            float zMin;
+            float zMax;
+        };
+        bool interpolate;
+        StreamedFrame previousFrame, latestFrame;
+        double arrivalTime; // when the latest frame was uploaded
+
+
+        // std140 Camera block shared by all programs
+        struct CameraUniforms {
+            glm::mat4 model;
+            glm::mat4 view;
+            glm::mat4 projection;
+        };
+        uint cameraUBO;
+
+        void initWindow(void);
+        void initHeadless(void);
         void initDrawingData(void);
+        void setSurfaceUniforms(const SurfaceFrame& surface); // camera block and the surface shader's uniforms
+        void setSurfacePlotAttributes(VertexFormat format, size_t offset);
+        char* beginStreamFrame(size_t size); // next free region, NULL when not streaming
+        void fenceStreamRegion(uint region);  // the region can be rewritten once the GPU has passed this point
+        float getPreviousWeight(void);        // of the previous frame in the blend, 0 draws the latest frame only
+        void setPreviousHeightAttribute(VertexFormat format, size_t offset);
+        void createStreamBuffer(size_t regionSize);
+        void deleteStreamBuffer(void);
+        static void waitForFence(GLsync& fence);
+        Shader& getSurfacePlotShader(VertexFormat format);
+        static Topology getStyleTopology(SurfaceStyle style); // primitives the style draws
+        const SurfaceFrame& generateFrame(float time);
         static glm::vec3 getArcballVector(float x, float y); // helper to cursor callback, (x,y) are raw mouse coordinates
 
     public:
@@ -44,17 +182,36 @@ class GLProgram {
 
         GLProgram();
 
-        void init(const char* vertexPath, const char* fragmentPath, const char* whiteFragmentPath);
-        void run(void);
+        void init(const char* vertexPath, const char* heightVertexPath, const char* fragmentPath, const char* whiteFragmentPath,
+                  const char* computePath);
+        bool run(void); // false if the compute check failed
+        bool renderFrames(const std::vector<float>& times, const std::string& outputPattern, int frameRate); // headless, one frame per time
         void cleanup(void);
 
         void setClearColor(float r, float g, float b, float alpha);
+        bool setFunction(const std::string& source, std::string* error = NULL);
+        void setNumThreads(uint numThreads);
+        void setExact(bool exact);
+        void setPeriod(float period);      // of the animation cache, 0 finds it in the function
+        void setCacheBudget(size_t bytes); // keyframes of the animation cache, 0 disables it
+        void setVertexFormat(VertexFormat format);
+        void setSurfaceStyle(SurfaceStyle style);
+        void setGridLineWidth(float width); // pixels, of the grid style
+        void setStreaming(bool streaming); // persistent mapped vertex stream, otherwise glBufferData every frame
+        void setAsync(bool async);         // generate frames on a producer thread, otherwise in the render loop
+        void setTiming(bool timing);       // print a per-phase frame time breakdown every TIMING_INTERVAL seconds
+        void setOnDemand(bool onDemand);   // draw static surfaces only after input instead of every frame
+        void setInterpolate(bool interpolate); // blend between producer frames on the GPU, when streaming
+        void setHeadless(bool headless);   // render offscreen at windowWidth x windowHeight, before init
+        bool setCapture(const std::string& pattern); // record the window to images or a .y4m video from the first frame
+        void setCompute(bool compute);           // evaluate parsed functions in a compute shader, before init
+        void setComputeCheck(bool computeCheck); // compare every compute shader frame with the CPU
 
         uint generateBuffer(void);
         uint generateVAO(void);
 
-        void drawSurfacePlot(void);
-        void drawCube(void);
+        void drawSurfacePlot(const SurfaceFrame& frame);
+        void drawCube(const SurfaceFrame& frame);
 
         // transformation matrices
         glm::mat4 getViewMatrix(void);
@@ -66,6 +223,7 @@ class GLProgram {
         static void scrollCallback(GLFWwindow* window, double xoffset, double yoffset);
         static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
         static void cursorPosCallback(GLFWwindow* window, double xpos, double ypos);
+        static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
         // input
         void processInput(void);
@@ -0,0 +1,31 @@
+#ifndef HEADLESSCONTEXT_H
+#define HEADLESSCONTEXT_H
+
+#include <glad/glad.h>
+
+#define HEADLESS_SAMPLES 4 // multisampling of the offscreen framebuffer, as requested for the window
+
+// offscreen OpenGL context for hosts without a display: an EGL surfaceless context (e.g. Mesa llvmpipe)
+// rendering into a multisampled framebuffer object that is resolved for readback
+class HeadlessContext {
+    private:
+        void* display; // EGLDisplay
+        void* context; // EGLContext
+        GLuint framebuffer, colorBuffer, depthBuffer;
+        GLuint resolveFramebuffer, resolveColorBuffer;
+        int width, height;
+
+    public:
+        HeadlessContext();
+
+        bool create(void); // makes the context current, load GL functions with getProcAddress afterwards
+        bool createFramebuffer(int width, int height);
+        void destroy(void);
+
+        static void* getProcAddress(const char* name);
+
+        // resolves the samples of the frame drawn so far and binds the result as GL_READ_FRAMEBUFFER
+        void resolve(void);
+};
+
+#endif //HEADLESSCONTEXT_H
@@ -0,0 +1,19 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <string>
+
+#define PNG_COMPRESSION 1 // zlib level, frames are written in bulk so speed wins over size
+
+// writes 8-bit RGB pixels stored bottom row first, as glReadPixels returns them,
+// as PNG or, for a .ppm path, as a raw binary PPM frame
+bool writeImage(const std::string& path, const unsigned char* pixels, int width, int height);
+
+// case insensitive, extension includes the dot
+bool hasExtension(const std::string& path, const char* extension);
+
+// expands a printf style frame pattern with a single %d (optionally zero padded, e.g. %04d),
+// returns false if the pattern has no such field or any other conversion
+bool formatFramePath(const std::string& pattern, int index, std::string& path);
+
+#endif //IMAGEWRITER_H
@@ -2,6 +2,7 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -10,17 +11,47 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#define UNIFORM_TABLE_SIZE 32 // power of two, more than the active uniforms of any program
+#define PROGRAM_CACHE_MAGIC 0x43425053 // "SPBC", first word of every program binary cache entry
+#define PROGRAM_CACHE_VERSION 1
+
+// linked program binaries are cached in $SURFACE_PLOTTER_SHADER_CACHE, default $XDG_CACHE_HOME/3DSurfacePlotter
+// or ~/.cache/3DSurfacePlotter, an empty SURFACE_PLOTTER_SHADER_CACHE disables the cache
+
 class Shader {
     public:
         uint ID;
         Shader();
         Shader(const char* vertexPath, const char* fragmentPath);
+        Shader(const char* computePath, const std::string& appendedCode); // compute program, generated code follows the file
         void use(void);
-        void setFloatUniform(const std::string &name, float value) const;
-        void setVec3Uniform(const std::string &name, glm::vec3 value) const;
-        void setMat4Uniform(const std::string &name, glm::mat4 value) const;
+        void setIntUniform(const char* name, int value) const;
+        void setFloatUniform(const char* name, float value) const;
+        void setVec2Uniform(const char* name, glm::vec2 value) const;
+        void setVec3Uniform(const char* name, glm::vec3 value) const;
+        void setMat4Uniform(const char* name, glm::mat4 value) const;
 
     private:
+        // uniform locations resolved at link time, open addressing on the hashed name
+        struct UniformSlot {
+            uint32_t hash;
+            int location;
+            std::string name; // empty for unused slots
+        };
+        UniformSlot uniforms[UNIFORM_TABLE_SIZE];
+
+        // program binary cache, entries are keyed by the sources and the driver that built them
+        bool loadProgramBinary(const std::string& path, uint64_t key);
+        void saveProgramBinary(const std::string& path, uint64_t key);
+        static std::string getProgramCachePath(const std::string& vertexCode, const std::string& fragmentCode, uint64_t& key);
+        void compile(const char* vertexCode, const char* fragmentCode, bool retrievable);
+        void compileCompute(const char* computeCode, bool retrievable);
+        static std::string readShaderFile(const char* path);
+
+        void cacheUniformLocations(void);
+        int getUniformLocation(const char* name) const; // -1 if the program has no such uniform, which glUniform* ignores
+        static uint32_t hashName(const char* name);
+
         void checkCompileErrors(uint shader, std::string type);
 };
 
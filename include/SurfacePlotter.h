@@ -4,19 +4,63 @@
 #include <iostream>
 #include <vector>
 
+#include <string>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "AlignedBuffer.h"
+#include "Expression.h"
+#include "ThreadPool.h"
+
 #define PI 3.14159265
-#define e 2.71828
 #define FLOAT_MIN -2147483648
 #define FLOAT_MAX 2147483648
+#define GRID_EPSILON 1e-3 // fraction of a grid step tolerated when counting grid points
+#define BANDS_PER_THREAD 4 // grid row bands per worker thread, for load balancing
+#define RADIAL_OVERSAMPLING 4   // radial profile samples per grid interval, before refinement
+#define RADIAL_REFINEMENTS 3    // times the profile spacing may be halved to meet RADIAL_TOLERANCE
+#define RADIAL_TOLERANCE 1e-4   // largest estimated interpolation error of the radial profile, relative to the z range
+#define ANIMATION_CACHE_BUDGET (64 << 20) // default bytes of keyframes for a periodic function
+#define ANIMATION_MIN_KEYFRAMES 8         // fewer per period are not worth caching
+#define ANIMATION_MAX_KEYFRAMES 256       // power of two
+#define ANIMATION_CACHE_TOLERANCE 1e-3    // largest interpolation error between keyframes, relative to the z range
+#define PRIMITIVE_RESTART_INDEX 0xFFFFFFFFu // ends a triangle strip, never a vertex index
+
+// default plotted function (sombrero equation), other samples:
+//     "sin((x/2.5)^2 + (y/2.5)^2)"
+//     "((x/1.5)^2 + (y/1.5)^2) * 0.3" (parabaloid)
+#define DEFAULT_FUNCTION "sin(t)*8*sin(sqrt(x^2+y^2))/sqrt(x^2+y^2)"
+
+typedef float (*NativeFunction)(float x, float y, float t);
+
+// layout of the per-vertex data uploaded to the GPU
+enum VertexFormat {
+    VERTEX_FORMAT_FULL,       // x, y, z floats
+    VERTEX_FORMAT_HEIGHT,     // z float, x and y rebuilt from gl_VertexID in the vertex shader
+    VERTEX_FORMAT_HALF_HEIGHT // z half float, x and y rebuilt from gl_VertexID in the vertex shader
+};
+
+// primitives indexed into the vertices, line segments come before triangle strips
+enum Topology {
+    TOPOLOGY_LINES,          // line segments of the wireframe
+    TOPOLOGY_TRIANGLES,      // one triangle strip per pair of grid lines, joined by PRIMITIVE_RESTART_INDEX
+    TOPOLOGY_LINES_TRIANGLES // both
+};
+
+// data that changed since the GPU copy was last uploaded
+enum DirtyFlags {
+    DIRTY_VERTICES = 1,
+    DIRTY_INDICES = 2,
+    DIRTY_CUBE = 4
+};
 
 class SurfacePlotter {
     private:
-        // xy grid
-        std::vector<std::vector<glm::vec2>> gridPoints; // 2D array of grid x, y coordinates
+        // xy grid, described by its origin, step and counts
+        size_t numX;
+        size_t numY;
         float xMin;
         float xMax;
         float yMin;
@@ -24,37 +68,230 @@ class SurfacePlotter {
         float gridInterval;
         float zMin;
         float zMax;
+        size_t numInvalid; // NaN and infinite samples of the last frame, left out of the z range and the indices
+        size_t numEvaluations; // of f or its parts in the last frame
+
+        // plotted function, a compiled native function takes precedence over the parsed expression
+        Expression expression;
+        NativeFunction nativeFunction;
+        Symmetry symmetry; // detected for parsed expressions, declared for native functions
+        bool exact;        // evaluate every grid point regardless of symmetry
+
+        // radially symmetric functions are sampled along one radius, f(k*radialStep, 0, t), and the grid
+        // is interpolated from the profile, O(numX + numY) evaluations instead of O(numX * numY)
+        AlignedBuffer<float> sampleCoordinates; // radii of the profile, or grid coordinates of the separable parts
+        AlignedBuffer<float> radialProfile;
+        AlignedBuffer<float> radialSlopes; // dz/dr at the profile's radii
+        float radialStep;
+        bool radialHasSlopes;
+        bool radialReady; // the profile holds this frame within RADIAL_TOLERANCE
+
+        bool buildRadialProfile(float time);
+        size_t lookupRadialProfile(float x, const float* ys, float time, float* z, float* dzdx, float* dzdy, size_t n); // returns exact evaluations
+
+        // separable functions are evaluated once per grid line and once per grid column, g(x, t) and h(y, t),
+        // and combined in an outer product pass, O(numX + numY) evaluations
+        Expression separableX; // g(x, t) and h(y, t) of a separable parsed expression
+        Expression separableY;
+        Expression separableXGradient; // g and dg/dx
+        Expression separableYGradient; // h and dh/dy
+        AlignedBuffer<float> separableXs; // this frame's g at every grid line
+        AlignedBuffer<float> separableYs; // this frame's h at every grid column
+        AlignedBuffer<float> separableXSlopes; // dg/dx and dh/dy, the same way
+        AlignedBuffer<float> separableYSlopes;
+        bool separableHasSlopes;
+        bool separableReady;
+
+        bool evaluateSeparable(float time);
+
+        // parsed functions a(t) * g(x, y) + b(t) evaluate g once per grid, each frame is then one fused
+        // multiply-add pass over the cached field and its z range follows from the field's
+        Expression timeScale;  // a(t)
+        Expression timeField;  // g(x, y)
+        Expression timeOffset; // b(t)
+        Expression timeFieldGradient; // g(x, y), dg/dx and dg/dy
+        bool timeFactored;
+        AlignedBuffer<float> fieldValues;
+        AlignedBuffer<float> fieldSlopesX; // dz/dx of a frame is a(t) * dg/dx, likewise for y
+        AlignedBuffer<float> fieldSlopesY;
+        bool fieldHasSlopes;
+        AlignedBuffer<uint8_t> fieldValidity;
+        float fieldMin;
+        float fieldMax;
+        size_t fieldInvalid;
+        bool fieldCurrent; // the field holds g on the current grid
+        float frameScale;  // a and b of this frame
+        float frameOffset;
+        bool factoredReady;
+
+        bool prepareTimeField(float time);
+        void buildTimeField(void);
+
+        // periodic functions are sampled at numKeyframes phases of one period, kept in one allocation, and
+        // frames are interpolated between neighbouring keyframes. One keyframe is evaluated per frame in
+        // bit-reversed order, so the cache fills level by level (1, 2, 4, ... keyframes per period) and each
+        // new keyframe measures the midpoint error of the previous level; playback starts with the first
+        // level within ANIMATION_CACHE_TOLERANCE and the cache is given up if none is
+        float declaredPeriod; // 0 finds the period in the expression
+        float period;         // of the function plotted, 0 without a cache
+        size_t cacheBudget;   // bytes of keyframes at most
+        AlignedBuffer<float> keyframes;
+        uint numKeyframes;    // power of two, 0 until the first frame
+        uint keyframesFilled;
+        uint keyframeStride;  // between the keyframes played back, 0 until a level is within the tolerance
+        float keyframeError;  // largest midpoint error of the level being measured
+        float keyframeMin;    // finite range of the keyframes filled so far
+        float keyframeMax;
+        bool cacheFailed;     // no level within the tolerance, or not enough keyframes in the budget
+        const float* keyframeFrom; // this frame's neighbouring keyframes and the weight of the second
+        const float* keyframeTo;
+        float keyframeWeight;
+        bool cacheReady;
+
+        void resetAnimationCache(void);
+        bool prepareAnimationCache(float time);
+        void fillKeyframe(void);
+
+        // parallel vertex generation, each band of grid rows keeps its own z range
+        struct Band {
+            float zMin;
+            float zMax;
+            size_t numInvalid;
+            size_t numEvaluations;
+            float keyframeError;
+            AlignedBuffer<float> ys; // scratch grid line, reused across frames
+            AlignedBuffer<float> zs;
+            AlignedBuffer<float> dzdx;
+            AlignedBuffer<float> dzdy;
+        };
+        ThreadPool threadPool;
+        std::vector<Band> bands;
 
-        // surface plot data
-        float* vertices;
-        uint numElements;
-        uint* indices;
-        uint numIndices;
+        void generateRows(size_t xBegin, size_t xEnd, float time, Band& range);
+
+        // grid coordinates from integer indices, no accumulated rounding error
+        float getGridX(size_t i) const { return this->xMin + i * this->gridInterval; }
+        float getGridY(size_t j) const { return this->yMin + j * this->gridInterval; }
+
+        // surface plot data, storage is reused until the grid grows
+        VertexFormat vertexFormat;
+        AlignedBuffer<float> vertices;         // full and height formats
+        AlignedBuffer<uint16_t> halfVertices; // half height format
+        void* vertexTarget;                   // external destination replacing the buffers above, e.g. mapped GPU memory
+
+        // per-vertex normals for lighting follow the vertices in the same data, octahedral encoded (see encodeNormals);
+        // parsed functions are differentiated once by forward mode automatic differentiation, so each grid line is
+        // evaluated with its slopes dz/dx and dz/dy in the same pass, and the fast paths carry the slopes of their
+        // parts along. Native functions and keyframes have no slopes, periodic functions skip the cache for them
+        Expression gradient; // f, df/dx and df/dy
+        bool normals;        // requested
+        bool normalsReady;   // the vertex data holds this frame's normals
+
+        bool hasNormalData(void); // the vertex data has room for normals
+        uint32_t* getNormalTarget(void);
+
+        Topology topology;
+        AlignedBuffer<uint> indices;
+        size_t numLineIndices; // the triangle strips start after them
+        AlignedBuffer<uint8_t> validity;      // per vertex, 1 for finite samples
+        AlignedBuffer<uint8_t> indexValidity; // validity the indices were built from
+        bool indicesMasked;                   // indices leave out invalid samples
+        bool verticesCurrent; // vertices match the function and grid at verticesTime
+        bool externalCurrent; // so do the vertices last generated elsewhere, see setExternalSurface
+        float verticesTime;
+
+        void generateIndices(const uint8_t* valid = NULL); // NULL connects every grid point
+        size_t generateStrips(const uint8_t* valid, uint* strips); // returns the number of indices written
+        void updateIndices(const uint8_t* valid);
 
         // cube data
-        float* cubeVertices;
-        uint* cubeIndices;
+        float cubeVertices[24];
+        uint cubeIndices[24];
+
+        uint dirtyFlags;
 
     public:
         SurfacePlotter();
 
+        bool setFunction(const std::string& source, std::string* error = NULL); // returns false if source fails to parse
+        void setFunction(NativeFunction function, Symmetry symmetry = SYMMETRY_NONE);
+        const Expression& getExpression(void);
+        NativeFunction getNativeFunction(void); // NULL while the parsed expression is plotted
+        Symmetry getSymmetry(void);
+        size_t getNumEvaluations(void); // function evaluations of the last frame, numX * numY without symmetry
+        bool isTimeFactored(void);      // a(t) * g(x, y) + b(t), g is cached per grid
+        bool dependsOnTime(void);       // false when t does not appear, native functions always depend on it
+
+        // true evaluates f at every grid point, for reference and comparison
+        void setExact(bool exact);
+
+        // animation cache of periodic functions, whose period is found in the expression unless declared,
+        // native functions need a declared period; a budget of 0 bytes disables the cache
+        void setPeriod(float period); // 0 finds it in the expression
+        float getPeriod(void);        // of the cached function, 0 if it has no cache
+        void setCacheBudget(size_t bytes);
+        bool isCached(void);          // the last frame was interpolated between keyframes
+        size_t getCacheSize(void);    // bytes of keyframes filled
+
         void setGrid(float xMin, float xMax, float yMin, float yMax, float interval);
+
+        // static functions are evaluated once and reused until the function, grid, format or target changes
         void generateSurfacePlot(float time);
+
+        // vertices were generated elsewhere at time, e.g. by a compute shader, the vertices held here are stale
+        // until the next generateSurfacePlot
+        void setExternalSurface(float time);
+
+        // z range and validity of vertices generated elsewhere, which may arrive frames after them, updates the
+        // cube and masks the indices like generateSurfacePlot, valid may be NULL when numInvalid is 0
+        void setExternalRange(float zMin, float zMax, size_t numInvalid, const uint8_t* valid);
+
+        // the surface at time was already generated, here or elsewhere, so it need not be generated again
+        bool isCurrent(float time);
+        void invalidateVertices(void); // the next generateSurfacePlot evaluates again, even a static function
         float f(float x, float y, float t); // mathematical multi-variable function, returns z value
 
+        void setNumThreads(uint numThreads); // 0 uses one thread per hardware thread
+        uint getNumThreads(void);
+
         void generateCube(void);
 
+        size_t getNumX(void);
+        size_t getNumY(void);
+
         float getZMin(void);
         float getZMax(void);
         float getZRange(void);
+        size_t getNumInvalid(void);
+
+        void setVertexFormat(VertexFormat format);
+        VertexFormat getVertexFormat(void);
+        void setTopology(Topology topology); // rebuilds the indices, the vertices are unaffected
+        Topology getTopology(void);
+        void setNormals(bool normals);
+        bool getNormals(void);
+        bool hasNormals(void);       // the vertex data of the last frame holds its normals
+        size_t getNormalOffset(void); // bytes from the start of the vertex data while normals are requested, a multiple of 4
+        glm::vec2 getGridOrigin(void);
+        float getGridInterval(void);
 
         float* getVertices(void);
-        uint getNumElements(void);
+        uint getNumElements(void);       // floats of the vertices, without the normals, 0 in the half height format
+        const void* getVertexData(void); // vertices in the current vertex format, followed by the normals if requested
+        size_t getVertexDataSize(void);  // bytes
+
+        // vertices are written to target instead of internal storage, target must hold getVertexDataSize() bytes,
+        // NULL restores internal storage
+        void setVertexTarget(void* target);
         uint* getIndices(void);
         uint getNumIndices(void);
+        uint getNumLineIndices(void); // line segments, the rest are triangle strips
 
         float* getCubeVertices(void);
         uint* getCubeIndices(void);
+
+        uint getDirtyFlags(void);
+        void clearDirtyFlags(uint flags);
 };
 
 #endif //SURFACEPLOTTER_H
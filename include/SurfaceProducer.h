@@ -0,0 +1,97 @@
+#ifndef SURFACEPRODUCER_H
+#define SURFACEPRODUCER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "AlignedBuffer.h"
+#include "SurfacePlotter.h"
+
+#define PRODUCER_IDLE_TIMEOUT 100 // milliseconds, bounds a wake-up missed by a producer idling on a static surface
+
+// generated surface as handed to the renderer
+struct SurfaceFrame {
+    uint id; // increases with every generated frame, 0 before the first
+    float time;
+    float zMin;
+    float zMax;
+    VertexFormat format;
+    const void* vertexData;
+    size_t vertexDataSize;
+    bool hasNormals;     // octahedral normals follow the vertices at normalOffset
+    size_t normalOffset;
+    float cubeVertices[24];
+    const uint* indices; // valid when dirtyFlags has DIRTY_INDICES
+    size_t numIndices;
+    size_t numLineIndices; // the rest are triangle strips
+    Topology topology;
+    size_t numInvalid; // non-finite samples, left out of the indices
+    uint dirtyFlags; // what changed since the previous frame
+    bool gpuVertices; // the GPU wrote the vertices into the vertex buffer and their z range into its range buffer,
+                      // vertexData is stale and the z range may be
+    double generateTime; // seconds spent generating this frame
+
+    AlignedBuffer<char> storage; // vertex data of frames generated on the producer thread
+    AlignedBuffer<uint> indexStorage; // the producer thread rebuilds the indices when the invalid samples change
+
+    SurfaceFrame();
+
+    // takes the surface plotter's current state and dirty flags, plus the flags of frames that were
+    // dropped before the renderer took them
+    void capture(SurfacePlotter& surfacePlotter, uint id, uint droppedFlags = 0);
+};
+
+// generates surface frames on a thread of its own so that a slow function does not stall rendering,
+// finished frames are handed to the render thread through a lock-free triple buffer, a newer frame replaces
+// one the render thread has not taken yet
+class SurfaceProducer {
+    private:
+        SurfacePlotter& surfacePlotter; // owned by the producer thread while running
+        double (*clock)(void);
+        void (*notify)(void); // called after a frame is published, may be NULL
+        std::thread thread;
+        std::atomic<bool> running;
+        std::atomic<int> vertexFormat; // applied by the producer thread before its next frame
+        std::atomic<int> topology;     // likewise
+        std::atomic<bool> normals;     // likewise
+        uint numFrames;
+        uint droppedFlags; // dirty flags of replaced frames, carried into the next one
+
+        // the producer writes frames[back] and the render thread reads frames[front], middle is
+        // the last published frame, flagged FRESH until the render thread takes it
+        SurfaceFrame frames[3];
+        uint back;
+        uint front;
+        std::atomic<uint> middle;
+
+        // the producer sleeps here while a static surface has nothing new to generate
+        std::mutex mutex;
+        std::condition_variable settingsChanged;
+
+        void generate(SurfaceFrame& frame);
+        void producerLoop(void);
+
+    public:
+        SurfaceProducer(SurfacePlotter& surfacePlotter);
+        ~SurfaceProducer();
+
+        SurfaceProducer(const SurfaceProducer&) = delete;
+        SurfaceProducer& operator=(const SurfaceProducer&) = delete;
+
+        // generates the first frame on the calling thread, then starts the producer thread, which
+        // sleeps after one frame of a static surface until the vertex format, topology or normals change
+        void start(double (*clock)(void), void (*notify)(void) = NULL);
+        void stop(void);
+        bool isRunning(void);
+
+        void setVertexFormat(VertexFormat format);
+        void setTopology(Topology topology);
+        void setNormals(bool normals);
+
+        // newest completed frame, never blocks, valid until the next call
+        const SurfaceFrame& acquireFrame(void);
+};
+
+#endif //SURFACEPRODUCER_H
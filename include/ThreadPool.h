@@ -0,0 +1,54 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent worker threads that split an indexed loop between them, the calling thread also takes tasks
+class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable workDone;
+
+        // current job, published under the mutex and identified by its generation
+        void (*invoke)(void* context, uint task);
+        void* context;
+        uint numTasks;
+        std::atomic<uint> nextTask;
+        uint activeWorkers;
+        uint generation;
+        bool stopping;
+
+        void workerLoop(uint seen); // seen is the last job generation before the worker started
+        void runTasks(void);
+        void run(uint numTasks, void (*invoke)(void* context, uint task), void* context);
+        void stopWorkers(void);
+
+        template <class Function>
+        static void invokeFunction(void* function, uint task) {
+            (*static_cast<Function*>(function))(task);
+        }
+
+    public:
+        ThreadPool(uint numThreads = 0); // 0 uses one thread per hardware thread
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        void setNumThreads(uint numThreads);
+        uint getNumThreads(void) const;
+
+        // calls function(task) for every task in [0, numTasks) and returns when all have finished
+        template <class Function>
+        void parallelFor(uint numTasks, Function& function) {
+            run(numTasks, invokeFunction<Function>, &function);
+        }
+};
+
+#endif //THREADPOOL_H
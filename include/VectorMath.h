@@ -0,0 +1,89 @@
+#ifndef VECTORMATH_H
+#define VECTORMATH_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Expression.h"
+
+// elementwise kernel over float arrays: dst[i] = op(a[i], b[i]), unary kernels ignore b
+typedef void (*VectorOp)(float* dst, const float* a, const float* b, size_t n);
+
+// float to IEEE 754 binary16 conversion, rounds to nearest even
+typedef void (*HalfOp)(const float* src, uint16_t* dst, size_t n);
+
+// fused z range pass: widens zMin and zMax by the finite samples, sets valid[i] to 1 for finite
+// samples and 0 for NaN and infinities, returns the number of non-finite samples
+typedef size_t (*RangeOp)(const float* z, uint8_t* valid, size_t n, float* zMin, float* zMax);
+
+// outer product of a scalar and an array: dst[i] = op(a, b[i])
+typedef void (*BroadcastOp)(float* dst, float a, const float* b, size_t n);
+
+// scaled and offset array: dst[i] = a * src[i] + b, fused where the instruction set has FMA
+typedef void (*AffineOp)(float* dst, float a, const float* src, float b, size_t n);
+
+// linear interpolation of two arrays: dst[i] = a[i] + w * (b[i] - a[i])
+typedef void (*BlendOp)(float* dst, const float* a, const float* b, float w, size_t n);
+
+// largest |z[i] - (a[i] + b[i]) / 2| over the samples finite in all three arrays, infinity as soon as
+// z[i] is finite where a[i] or b[i] is not or the other way round
+typedef float (*MidpointOp)(const float* z, const float* a, const float* b, size_t n);
+
+// radial profile lookup: z[i] = profile linearly interpolated at sqrt(x^2 + ys[i]^2) / step,
+// profile holds last + 2 samples and the radii are not negative
+typedef void (*RadialOp)(const float* profile, int last, float step, float x, const float* ys, float* z, size_t n);
+
+// surface normals (-scale * dzdx[i], -scale * dzdy[i], 1) of the upper hemisphere, octahedral encoded: projected onto
+// |x| + |y| + |z| = 1 and packed as two signed normalized 16 bit integers, x in the low half, non-finite slopes face up
+typedef void (*NormalOp)(const float* dzdx, const float* dzdy, float scale, uint32_t* dst, size_t n);
+
+// kernel table for one instruction set, indexed by Opcode
+struct VectorMath {
+    const char* name;
+    VectorOp ops[NUM_OPCODES];
+    HalfOp toHalf;
+    RangeOp range;
+    RadialOp radial;
+    BroadcastOp broadcastAdd;
+    BroadcastOp broadcastMul;
+    AffineOp affine;
+    BlendOp blend;
+    MidpointOp midpointError;
+    NormalOp normals;
+};
+
+// best table supported by the running CPU, the SURFACE_PLOTTER_ISA environment
+// variable (scalar, sse4, avx2) can force a lower instruction set for comparison
+const VectorMath& getVectorMath(void);
+
+// per instruction set tables, NULL when the instruction set was not compiled in
+const VectorMath* getScalarVectorMath(void);
+const VectorMath* getSSE4VectorMath(void);
+const VectorMath* getAVX2VectorMath(void);
+
+// half float vertex data, converted with the selected table
+void convertToHalf(const float* src, uint16_t* dst, size_t n);
+
+// z range and validity of a grid line, with the selected table
+size_t accumulateRange(const float* z, uint8_t* valid, size_t n, float* zMin, float* zMax);
+
+// separable grid line g + h[i] or g * h[i], with the selected table
+void broadcastAdd(float* dst, float a, const float* b, size_t n);
+void broadcastMul(float* dst, float a, const float* b, size_t n);
+
+// time factored grid line a * g[i] + b, with the selected table
+void scaleOffset(float* dst, float a, const float* src, float b, size_t n);
+
+// grid line between two keyframes, with the selected table
+void blend(float* dst, const float* a, const float* b, float w, size_t n);
+
+// interpolation error of a grid line against the midpoint of two keyframes, with the selected table
+float midpointError(const float* z, const float* a, const float* b, size_t n);
+
+// octahedral normals of a grid line from its slopes, with the selected table
+void encodeNormals(const float* dzdx, const float* dzdy, float scale, uint32_t* dst, size_t n);
+
+// radially symmetric grid line from its profile, with the selected table
+void interpolateRadial(const float* profile, int last, float step, float x, const float* ys, float* z, size_t n);
+
+#endif //VECTORMATH_H
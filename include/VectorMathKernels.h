@@ -0,0 +1,393 @@
+#ifndef VECTORMATHKERNELS_H
+#define VECTORMATHKERNELS_H
+
+// SIMD kernels shared by the instruction set specific translation units. Each unit
+// includes this header with its own traits class V, compiled with matching target flags.
+//
+// V provides the float vector type F, the integer vector type I, WIDTH, and the
+// load/store/arithmetic/compare/select primitives used below.
+//
+// The transcendental functions follow the single precision Cephes polynomials.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "VectorMath.h"
+
+template <class V>
+struct VectorKernels {
+    typedef typename V::F F;
+    typedef typename V::I I;
+
+    static inline F signMask(void) { return V::castif(V::iset1(0x80000000)); }
+    static inline F absMask(void) { return V::castif(V::iset1(0x7fffffff)); }
+
+    static inline F neg(F x) { return V::xor_(x, signMask()); }
+    static inline F abs(F x) { return V::and_(x, absMask()); }
+    static inline F isNaN(F x) { return V::cmpneq(x, x); }
+
+    // sin and cos share the range reduction
+    static inline void sincos(F x, F& s, F& c) {
+        F signSin = V::and_(x, signMask());
+        x = abs(x);
+
+        // j = (int)(x * 4/pi) rounded up to even, y = j
+        I j = V::cvtt(V::mul(x, V::set1(1.27323954473516f)));
+        j = V::iand(V::iadd(j, V::iset1(1)), V::iset1(~1));
+        F y = V::cvtif(j);
+
+        F swapSign = V::castif(V::slli(V::iand(j, V::iset1(4)), 29));
+        F polyMask = V::castif(V::icmpeq(V::iand(j, V::iset1(2)), V::iset1(0)));
+        F signCos = V::castif(V::slli(V::iandnot(V::isub(j, V::iset1(2)), V::iset1(4)), 29));
+        signSin = V::xor_(signSin, swapSign);
+
+        // extended precision modular arithmetic
+        x = V::fmadd(y, V::set1(-0.78515625f), x);
+        x = V::fmadd(y, V::set1(-2.4187564849853515625e-4f), x);
+        x = V::fmadd(y, V::set1(-3.77489497744594108e-8f), x);
+        F z = V::mul(x, x);
+
+        // cosine polynomial on [0, pi/4]
+        F yc = V::set1(2.443315711809948e-5f);
+        yc = V::fmadd(yc, z, V::set1(-1.388731625493765e-3f));
+        yc = V::fmadd(yc, z, V::set1(4.166664568298827e-2f));
+        yc = V::mul(V::mul(yc, z), z);
+        yc = V::fmadd(z, V::set1(-0.5f), yc);
+        yc = V::add(yc, V::set1(1.0f));
+
+        // sine polynomial on [0, pi/4]
+        F ys = V::set1(-1.9515295891e-4f);
+        ys = V::fmadd(ys, z, V::set1(8.3321608736e-3f));
+        ys = V::fmadd(ys, z, V::set1(-1.6666654611e-1f));
+        ys = V::fmadd(V::mul(ys, z), x, x);
+
+        s = V::xor_(V::select(polyMask, ys, yc), signSin);
+        c = V::xor_(V::select(polyMask, yc, ys), signCos);
+    }
+
+    // the reduction loses accuracy past this magnitude, such lanes use the C library
+    static inline bool needsScalarReduction(F x) {
+        return V::any(V::cmpgt(abs(x), V::set1(8192.0f)));
+    }
+
+    static inline F scalarFallback(F x, float (*function)(float)) {
+        alignas(32) float lanes[V::WIDTH];
+        V::store(lanes, x);
+        for (int i = 0; i < V::WIDTH; ++i)
+            lanes[i] = function(lanes[i]);
+        return V::load(lanes);
+    }
+
+    // C library entry points rather than the inline std:: wrappers, which would be
+    // emitted with this unit's target flags and could be shared with other units
+    static float scalarSin(float x) { return ::sinf(x); }
+    static float scalarCos(float x) { return ::cosf(x); }
+    static float scalarTan(float x) { return ::tanf(x); }
+
+    static inline F sin(F x, F) {
+        if (needsScalarReduction(x))
+            return scalarFallback(x, scalarSin);
+        F s, c;
+        sincos(x, s, c);
+        return s;
+    }
+
+    static inline F cos(F x, F) {
+        if (needsScalarReduction(x))
+            return scalarFallback(x, scalarCos);
+        F s, c;
+        sincos(x, s, c);
+        return c;
+    }
+
+    static inline F tan(F x, F) {
+        if (needsScalarReduction(x))
+            return scalarFallback(x, scalarTan);
+        F s, c;
+        sincos(x, s, c);
+        return V::div(s, c);
+    }
+
+    static inline F exp(F x, F) {
+        F original = x;
+        x = V::min(x, V::set1(88.3762626647949f));
+        x = V::max(x, V::set1(-88.3762626647949f));
+
+        // exp(x) = 2^n * exp(r), n = round(x / ln 2)
+        F fx = V::floor(V::fmadd(x, V::set1(1.44269504088896341f), V::set1(0.5f)));
+        x = V::fmadd(fx, V::set1(-0.693359375f), x);
+        x = V::fmadd(fx, V::set1(2.12194440e-4f), x);
+        F z = V::mul(x, x);
+
+        F y = V::set1(1.9875691500e-4f);
+        y = V::fmadd(y, x, V::set1(1.3981999507e-3f));
+        y = V::fmadd(y, x, V::set1(8.3334519073e-3f));
+        y = V::fmadd(y, x, V::set1(4.1665795894e-2f));
+        y = V::fmadd(y, x, V::set1(1.6666665459e-1f));
+        y = V::fmadd(y, x, V::set1(5.0000001201e-1f));
+        y = V::fmadd(y, z, V::add(x, V::set1(1.0f)));
+
+        I n = V::slli(V::iadd(V::cvtt(fx), V::iset1(0x7f)), 23);
+        y = V::mul(y, V::castif(n));
+
+        // overflow, underflow and NaN
+        y = V::select(V::cmpgt(original, V::set1(88.7228391f)), V::set1(INFINITY), y);
+        y = V::select(V::cmplt(original, V::set1(-88.3762626647949f)), V::set1(0.0f), y);
+        return V::select(isNaN(original), original, y);
+    }
+
+    static inline F log(F x, F) {
+        F original = x;
+        x = V::max(x, V::set1(1.17549435e-38f)); // smallest normal
+
+        // x = m * 2^e with m in [0.5, 1)
+        I exponent = V::srli(V::castfi(x), 23);
+        x = V::and_(x, V::castif(V::iset1(~0x7f800000)));
+        x = V::or_(x, V::set1(0.5f));
+        F e = V::add(V::cvtif(V::isub(exponent, V::iset1(0x7f))), V::set1(1.0f));
+
+        // move m to [sqrt(1/2), sqrt(2))
+        F mask = V::cmplt(x, V::set1(0.707106781186547524f));
+        F tmp = V::and_(x, mask);
+        x = V::sub(x, V::set1(1.0f));
+        e = V::sub(e, V::and_(V::set1(1.0f), mask));
+        x = V::add(x, tmp);
+        F z = V::mul(x, x);
+
+        F y = V::set1(7.0376836292e-2f);
+        y = V::fmadd(y, x, V::set1(-1.1514610310e-1f));
+        y = V::fmadd(y, x, V::set1(1.1676998740e-1f));
+        y = V::fmadd(y, x, V::set1(-1.2420140846e-1f));
+        y = V::fmadd(y, x, V::set1(1.4249322787e-1f));
+        y = V::fmadd(y, x, V::set1(-1.6668057665e-1f));
+        y = V::fmadd(y, x, V::set1(2.0000714765e-1f));
+        y = V::fmadd(y, x, V::set1(-2.4999993993e-1f));
+        y = V::fmadd(y, x, V::set1(3.3333331174e-1f));
+        y = V::mul(V::mul(y, x), z);
+
+        y = V::fmadd(e, V::set1(-2.12194440e-4f), y);
+        y = V::fmadd(z, V::set1(-0.5f), y);
+        x = V::add(x, y);
+        x = V::fmadd(e, V::set1(0.693359375f), x);
+
+        // zero, negative, infinite and NaN arguments
+        x = V::select(V::cmpeq(original, V::set1(0.0f)), V::set1(-INFINITY), x);
+        x = V::select(V::cmplt(original, V::set1(0.0f)), V::set1(NAN), x);
+        x = V::select(V::cmpeq(original, V::set1(INFINITY)), original, x);
+        return V::select(isNaN(original), original, x);
+    }
+
+    // pow(a, b) = exp(b * log|a|) with the C library sign and special value rules
+    static inline F pow(F a, F b) {
+        F r = exp(V::mul(b, log(abs(a), b)), b);
+
+        F integer = V::cmpeq(V::floor(b), b);
+        F half = V::mul(b, V::set1(0.5f));
+        F odd = V::and_(integer, V::cmpneq(V::floor(half), half));
+        F negative = V::cmplt(a, V::set1(0.0f));
+
+        r = V::select(V::and_(negative, odd), neg(r), r);
+        r = V::select(V::andnot(integer, negative), V::set1(NAN), r);
+        r = V::select(V::cmpeq(b, V::set1(0.0f)), V::set1(1.0f), r);
+        return V::select(V::cmpeq(a, V::set1(1.0f)), V::set1(1.0f), r);
+    }
+
+    static inline F add(F a, F b) { return V::add(a, b); }
+    static inline F sub(F a, F b) { return V::sub(a, b); }
+    static inline F mul(F a, F b) { return V::mul(a, b); }
+    static inline F div(F a, F b) { return V::div(a, b); }
+    static inline F negate(F a, F) { return neg(a); }
+    static inline F absolute(F a, F) { return abs(a); }
+    static inline F sqrt(F a, F) { return V::sqrt(a); }
+
+    // array loop, the tail is padded to a full vector so every element takes the same code path
+    template <F (*OP)(F, F)>
+    static void apply(float* dst, const float* a, const float* b, size_t n) {
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH)
+            V::storeu(dst + i, OP(V::loadu(a + i), V::loadu(b + i)));
+
+        if (i < n) {
+            alignas(32) float ta[V::WIDTH] = {0};
+            alignas(32) float tb[V::WIDTH] = {0};
+            memcpy(ta, a + i, (n - i) * sizeof(float));
+            memcpy(tb, b + i, (n - i) * sizeof(float));
+            V::store(ta, OP(V::load(ta), V::load(tb)));
+            memcpy(dst + i, ta, (n - i) * sizeof(float));
+        }
+    }
+
+    // z range of the finite samples, the lanes are reduced once at the end
+    static size_t range(const float* z, uint8_t* valid, size_t n, float* zMin, float* zMax) {
+        F lo = V::set1(*zMin);
+        F hi = V::set1(*zMax);
+        F infinity = V::set1(INFINITY);
+        size_t numInvalid = 0;
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH) {
+            F x = V::loadu(z + i);
+            F finite = V::cmplt(abs(x), infinity); // ordered compare, false for NaN
+            lo = V::min(lo, V::select(finite, x, lo));
+            hi = V::max(hi, V::select(finite, x, hi));
+
+            int bits = V::movemask(finite);
+            numInvalid += V::WIDTH - __builtin_popcount(bits);
+            for (int k = 0; k < V::WIDTH; ++k)
+                valid[i + k] = (bits >> k) & 1;
+        }
+
+        alignas(32) float los[V::WIDTH];
+        alignas(32) float his[V::WIDTH];
+        V::store(los, lo);
+        V::store(his, hi);
+
+        // plain comparisons, std::min and std::max would be emitted with this unit's target flags too
+        for (int k = 1; k < V::WIDTH; ++k) {
+            los[0] = (los[k] < los[0]) ? los[k] : los[0];
+            his[0] = (his[k] > his[0]) ? his[k] : his[0];
+        }
+        *zMin = los[0];
+        *zMax = his[0];
+
+        // tail
+        return numInvalid + getScalarVectorMath()->range(z + i, valid + i, n - i, zMin, zMax);
+    }
+
+    // scalar operand broadcast once, the tail is left to the scalar kernel
+    template <F (*OP)(F, F)>
+    static void broadcast(float* dst, float a, const float* b, size_t n, BroadcastOp scalar) {
+        F va = V::set1(a);
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH)
+            V::storeu(dst + i, OP(va, V::loadu(b + i)));
+        scalar(dst + i, a, b + i, n - i);
+    }
+
+    static void broadcastAdd(float* dst, float a, const float* b, size_t n) {
+        broadcast<add>(dst, a, b, n, getScalarVectorMath()->broadcastAdd);
+    }
+
+    static void broadcastMul(float* dst, float a, const float* b, size_t n) {
+        broadcast<mul>(dst, a, b, n, getScalarVectorMath()->broadcastMul);
+    }
+
+    static void affine(float* dst, float a, const float* src, float b, size_t n) {
+        F va = V::set1(a);
+        F vb = V::set1(b);
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH)
+            V::storeu(dst + i, V::fmadd(va, V::loadu(src + i), vb));
+        getScalarVectorMath()->affine(dst + i, a, src + i, b, n - i);
+    }
+
+    static void blend(float* dst, const float* a, const float* b, float w, size_t n) {
+        F vw = V::set1(w);
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH) {
+            F va = V::loadu(a + i);
+            V::storeu(dst + i, V::fmadd(vw, V::sub(V::loadu(b + i), va), va));
+        }
+        getScalarVectorMath()->blend(dst + i, a + i, b + i, w, n - i);
+    }
+
+    // samples that are not finite in all three arrays are masked to zero error
+    static float midpointError(const float* z, const float* a, const float* b, size_t n) {
+        F error = V::set1(0.0f);
+        F half = V::set1(0.5f);
+        F infinity = V::set1(INFINITY);
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH) {
+            F vz = V::loadu(z + i);
+            F va = V::loadu(a + i);
+            F vb = V::loadu(b + i);
+            F finite = V::and_(V::cmplt(abs(va), infinity), V::cmplt(abs(vb), infinity));
+            if (V::any(V::xor_(finite, V::cmplt(abs(vz), infinity))))
+                return INFINITY;
+            F difference = abs(V::sub(vz, V::mul(half, V::add(va, vb))));
+            error = V::max(error, V::and_(difference, finite));
+        }
+
+        alignas(32) float errors[V::WIDTH];
+        V::store(errors, error);
+        float tail = getScalarVectorMath()->midpointError(z + i, a + i, b + i, n - i);
+        for (int k = 0; k < V::WIDTH; ++k)
+            tail = (errors[k] > tail) ? errors[k] : tail;
+        return tail;
+    }
+
+    // the same rounding as the scalar kernel, the packed pairs are stored through the float view
+    static void normals(const float* dzdx, const float* dzdy, float scale, uint32_t* dst, size_t n) {
+        F vs = V::set1(-scale);
+        F one = V::set1(1.0f);
+        F unit = V::set1(32767.0f);
+        F half = V::set1(0.5f);
+        I low = V::iset1(0xffff);
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH) {
+            F gx = V::mul(vs, V::loadu(dzdx + i));
+            F gy = V::mul(vs, V::loadu(dzdy + i));
+            F inverse = V::div(one, V::add(V::add(abs(gx), abs(gy)), one));
+            F px = V::mul(gx, inverse);
+            F py = V::mul(gy, inverse);
+            F finite = V::and_(V::cmpeq(px, px), V::cmpeq(py, py));
+            px = V::and_(px, finite);
+            py = V::and_(py, finite);
+
+            I x = V::cvtt(V::fmadd(px, unit, V::or_(V::and_(px, signMask()), half)));
+            I y = V::cvtt(V::fmadd(py, unit, V::or_(V::and_(py, signMask()), half)));
+            F packed = V::or_(V::castif(V::iand(x, low)), V::castif(V::slli(y, 16)));
+            V::storeu(reinterpret_cast<float*>(dst + i), packed);
+        }
+        getScalarVectorMath()->normals(dzdx + i, dzdy + i, scale, dst + i, n - i);
+    }
+
+    // two gathers per lane, the index is clamped so the last interval extrapolates
+    static void radial(const float* profile, int last, float step, float x, const float* ys, float* z, size_t n) {
+        F xx = V::set1(x * x);
+        F invStep = V::set1(1.0f / step);
+        I lastIndex = V::iset1(last);
+        size_t i = 0;
+        for (; i + V::WIDTH <= n; i += V::WIDTH) {
+            F y = V::loadu(ys + i);
+            F u = V::mul(V::sqrt(V::fmadd(y, y, xx)), invStep);
+            I k = V::imin(V::cvtt(u), lastIndex);
+            F a = V::gather(profile, k);
+            F b = V::gather(profile + 1, k);
+            V::storeu(z + i, V::fmadd(V::sub(u, V::cvtif(k)), V::sub(b, a), a));
+        }
+
+        // tail
+        getScalarVectorMath()->radial(profile, last, step, x, ys + i, z + i, n - i);
+    }
+
+    // scalar table with every vectorized operation replaced
+    static VectorMath create(const char* name) {
+        VectorMath vm = *getScalarVectorMath();
+        vm.name = name;
+        vm.ops[OP_ADD] = apply<add>;
+        vm.ops[OP_SUB] = apply<sub>;
+        vm.ops[OP_MUL] = apply<mul>;
+        vm.ops[OP_DIV] = apply<div>;
+        vm.ops[OP_POW] = apply<pow>;
+        vm.ops[OP_NEG] = apply<negate>;
+        vm.ops[OP_ABS] = apply<absolute>;
+        vm.ops[OP_SQRT] = apply<sqrt>;
+        vm.ops[OP_EXP] = apply<exp>;
+        vm.ops[OP_LOG] = apply<log>;
+        vm.ops[OP_SIN] = apply<sin>;
+        vm.ops[OP_COS] = apply<cos>;
+        vm.ops[OP_TAN] = apply<tan>;
+        vm.range = range;
+        vm.radial = radial;
+        vm.broadcastAdd = broadcastAdd;
+        vm.broadcastMul = broadcastMul;
+        vm.affine = affine;
+        vm.blend = blend;
+        vm.midpointError = midpointError;
+        vm.normals = normals;
+        return vm;
+    }
+};
+
+#endif //VECTORMATHKERNELS_H
@@ -0,0 +1,139 @@
+#version 450 core
+
+// evaluates the surface on the implicit grid and writes the vertices straight into the vertex buffer,
+// f(x, y, t) is generated from the parsed function and appended to this file
+
+layout (local_size_x = 256) in; // matches COMPUTE_GROUP_SIZE
+
+// the vertex buffer range of this frame (binding matches COMPUTE_VERTEX_BINDING), viewed as floats
+// for the full and height formats and as packed half float pairs for the half height format
+layout (std430, binding = 1) writeonly buffer Vertices {
+    float vertices[];
+};
+layout (std430, binding = 1) writeonly buffer HalfVertices {
+    uint halfVertices[];
+};
+
+// z range as order preserving keys and the number of non-finite samples (binding matches COMPUTE_RANGE_BINDING)
+layout (std430, binding = 2) buffer Range {
+    uint zMinKey;
+    uint zMaxKey;
+    uint numInvalid;
+};
+
+// a bit per vertex, set for non-finite samples and cleared before the dispatch (binding matches COMPUTE_INVALID_BINDING)
+layout (std430, binding = 3) buffer Invalid {
+    uint invalidBits[];
+};
+
+uniform vec2 gridOrigin;
+uniform float gridInterval;
+uniform int gridNumX;
+uniform int gridNumY;
+uniform float t;
+uniform int vertexFormat; // VertexFormat: 0 full, 1 height, 2 half height
+
+shared float groupMin[gl_WorkGroupSize.x];
+shared float groupMax[gl_WorkGroupSize.x];
+
+const float NAN = uintBitsToFloat(0x7fc00000u);
+const float INFINITY = uintBitsToFloat(0x7f800000u);
+
+// GLSL leaves these undefined outside their domain, the CPU returns NaN or infinity like the C library
+float ieeeSqrt(float a) {
+    return (a < 0.0) ? NAN : sqrt(a);
+}
+
+float ieeeLog(float a) {
+    return (a < 0.0) ? NAN : (a == 0.0) ? -INFINITY : log(a);
+}
+
+float ieeeAsin(float a) {
+    return (abs(a) > 1.0) ? NAN : asin(a);
+}
+
+float ieeeAcos(float a) {
+    return (abs(a) > 1.0) ? NAN : acos(a);
+}
+
+float ieeePow(float a, float b) {
+    if (b == 0.0)
+        return 1.0;
+    if (a == 0.0)
+        return (b > 0.0) ? 0.0 : INFINITY;
+
+    // negative bases only have integer powers
+    float p = pow(abs(a), b);
+    if (a > 0.0)
+        return p;
+    if (b != floor(b))
+        return NAN;
+    return (mod(b, 2.0) == 1.0) ? -p : p;
+}
+
+float f(float x, float y, float t);
+
+// floats ordered as unsigned integers, so the range can be merged with atomicMin and atomicMax
+uint orderedKey(float value) {
+    uint bits = floatBitsToUint(value);
+    return ((bits & 0x80000000u) != 0u) ? ~bits : (bits | 0x80000000u);
+}
+
+void main() {
+    uint numVertices = uint(gridNumX * gridNumY);
+    uint perInvocation = (vertexFormat == 2) ? 2u : 1u;
+    uint first = gl_GlobalInvocationID.x * perInvocation;
+
+    // NaN and infinite samples are left out of the range and counted, as on the CPU
+    float zMin = INFINITY;
+    float zMax = -INFINITY;
+    float z[2] = float[2](0.0, 0.0);
+    for (uint k = 0u; k < perInvocation; ++k) {
+        uint i = first + k;
+        if (i >= numVertices)
+            break;
+
+        // the same rounding as the CPU grid, no fused multiply-add
+        precise float x = gridOrigin.x + float(i / uint(gridNumY)) * gridInterval;
+        precise float y = gridOrigin.y + float(i % uint(gridNumY)) * gridInterval;
+        z[k] = f(x, y, t);
+
+        if (vertexFormat == 0) {
+            vertices[3u * i] = x;
+            vertices[3u * i + 1u] = y;
+            vertices[3u * i + 2u] = z[k];
+        }
+        else if (vertexFormat == 1) {
+            vertices[i] = z[k];
+        }
+
+        if (!isnan(z[k]) && !isinf(z[k])) {
+            zMin = min(zMin, z[k]);
+            zMax = max(zMax, z[k]);
+        }
+        else {
+            atomicAdd(numInvalid, 1u);
+            atomicOr(invalidBits[i / 32u], 1u << (i % 32u));
+        }
+    }
+    if (vertexFormat == 2 && first < numVertices)
+        halfVertices[gl_GlobalInvocationID.x] = packHalf2x16(vec2(z[0], z[1]));
+
+    // tree reduction within the work group, then one atomic per group
+    uint local = gl_LocalInvocationID.x;
+    groupMin[local] = zMin;
+    groupMax[local] = zMax;
+    barrier();
+    for (uint stride = gl_WorkGroupSize.x / 2u; stride > 0u; stride /= 2u) {
+        if (local < stride) {
+            groupMin[local] = min(groupMin[local], groupMin[local + stride]);
+            groupMax[local] = max(groupMax[local], groupMax[local + stride]);
+        }
+        barrier();
+    }
+
+    if (local == 0u && groupMin[0] <= groupMax[0]) {
+        atomicMin(zMinKey, orderedKey(groupMin[0]));
+        atomicMax(zMaxKey, orderedKey(groupMax[0]));
+    }
+}
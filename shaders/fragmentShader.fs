@@ -1,11 +1,50 @@
-#version 460 core
+#version 450 core
 
 in vec3 fragPos;
+in vec3 fragNormal;
 
 out vec4 FragColor;
 
 uniform float zMin;
 uniform float zRange;
+uniform bool computedRange; // the z range is read from the compute shader's range buffer instead
+
+// z range as order preserving keys, written by computeShader.cs (binding matches COMPUTE_RANGE_BINDING)
+layout (std430, binding = 2) readonly buffer Range {
+    uint zMinKey;
+    uint zMaxKey;
+    uint numInvalid;
+};
+uniform int shading; // SurfaceShading: 0 gradient, 1 lit triangles, 2 wireframe overlay, 3 lit triangles with grid lines
+uniform bool analyticNormals; // fragNormal holds the interpolated normals of the function
+
+// implicit grid, whose lines the grid shading draws gridLineWidth pixels wide
+uniform vec2 gridOrigin;
+uniform float gridInterval;
+uniform float gridLineWidth;
+
+// directional light from above the surface, in model space
+const vec3 lightDirection = normalize(vec3(0.4, 0.3, 1.0));
+
+// coverage of the nearest grid line at this fragment, anti-aliased over one pixel
+float getGridLine(void) {
+
+    // grid coordinates are integers on the grid lines, fwidth converts their distance to pixels
+    vec2 grid = (fragPos.xy - gridOrigin) / gridInterval;
+    vec2 gridPerPixel = fwidth(grid);
+    vec2 pixels = abs(fract(grid + 0.5) - 0.5) / max(gridPerPixel, 1e-6);
+    vec2 coverage = clamp(0.5 * gridLineWidth + 0.5 - pixels, 0.0, 1.0);
+
+    // lines that would cover most of a cell fade out instead of aliasing into a solid colour,
+    // each direction on its own as steep surfaces compress one of them
+    coverage *= 1.0 - smoothstep(0.5, 0.8, max(gridLineWidth, 1.0) * gridPerPixel);
+    return max(coverage.x, coverage.y);
+}
+
+// inverse of orderedKey in computeShader.cs
+float fromOrderedKey(uint key) {
+    return uintBitsToFloat(((key & 0x80000000u) != 0u) ? (key & 0x7FFFFFFFu) : ~key);
+}
 
 // color gradient function
 vec4 getColor(float z) {
@@ -18,7 +57,16 @@ vec4 getColor(float z) {
     float startBlue = 0.7;
     float endBlue = 0.0;
 
-    float percentFade = (z-zMin)/zRange;
+    // a range without finite samples stays empty, as on the CPU
+    float low = zMin;
+    float range = zRange;
+    if (computedRange && zMinKey <= zMaxKey) {
+        low = fromOrderedKey(zMinKey);
+        float high = fromOrderedKey(zMaxKey);
+        range = (high == low) ? 1.0 : high - low;
+    }
+
+    float percentFade = (z-low)/range;
 
     float diffRed = endRed - startRed;
     float diffGreen = endGreen - startGreen;
@@ -33,5 +81,21 @@ vec4 getColor(float z) {
 
 void main() {
     float contrast = 0.6;
-    FragColor = getColor(fragPos.z);
+    vec4 color = getColor(fragPos.z);
+
+    // the function's own normal, or the facet normal from the screen space derivatives of the position,
+    // lit from both sides
+    if (shading == 1 || shading == 3) {
+        vec3 normal = analyticNormals ? normalize(fragNormal) : normalize(cross(dFdx(fragPos), dFdy(fragPos)));
+        float diffuse = abs(dot(normal, lightDirection));
+        color.rgb *= 0.35 + 0.65 * diffuse;
+    }
+
+    // grid lines darken like the wireframe overlay
+    if (shading == 2)
+        color.rgb *= 0.5;
+    else if (shading == 3)
+        color.rgb *= 1.0 - 0.5 * getGridLine();
+
+    FragColor = color;
 }
@@ -0,0 +1,46 @@
+#version 450 core
+
+// height-only vertices, x and y are rebuilt from the vertex index on the implicit grid
+layout (location = 0) in float height;
+layout (location = 1) in float previousHeight; // height of the previous frame, read while previousWeight > 0
+layout (location = 2) in vec2 normal; // octahedral upward normal, read while analyticNormals is set
+
+out vec3 fragPos;
+out vec3 fragNormal;
+
+// shared by every program, written once per frame (binding matches CAMERA_UBO_BINDING)
+layout (std140, binding = 0) uniform Camera {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+};
+
+uniform vec2 gridOrigin;
+uniform float gridInterval;
+uniform int gridNumY;
+
+// weight of the previous frame, falls from 1 to 0 between the arrival of a frame and the next one
+uniform float previousWeight;
+
+void main() {
+    int i = gl_VertexID / gridNumY;
+    int j = gl_VertexID - i * gridNumY;
+
+    // samples that were not finite in the previous frame are drawn as they are now
+    float z = height;
+    if (previousWeight > 0.0 && !isnan(previousHeight) && !isinf(previousHeight))
+        z = mix(height, previousHeight, previousWeight);
+
+    // non-finite samples are clipped away with the primitives they belong to, compute shader frames may be
+    // drawn with indices masked for an older frame, the clipper is given a finite position to cut towards
+    bool finite = !isnan(z) && !isinf(z);
+    gl_ClipDistance[0] = finite ? 0.0 : -1.0;
+    if (!finite)
+        z = 0.0;
+
+    vec3 pos = vec3(gridOrigin + vec2(i, j) * gridInterval, z);
+
+    gl_Position = projection * view * model * vec4(pos, 1.0);
+    fragNormal = vec3(normal, 1.0 - abs(normal.x) - abs(normal.y));
+    fragPos = pos;
+}
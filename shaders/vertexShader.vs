@@ -1,14 +1,37 @@
-#version 460 core
+#version 450 core
 
 layout (location = 0) in vec3 pos;
+layout (location = 1) in float previousHeight; // z of the previous frame, read while previousWeight > 0
+layout (location = 2) in vec2 normal; // octahedral upward normal, read while analyticNormals is set
 
 out vec3 fragPos;
+out vec3 fragNormal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// shared by every program, written once per frame (binding matches CAMERA_UBO_BINDING)
+layout (std140, binding = 0) uniform Camera {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+};
+
+// weight of the previous frame, falls from 1 to 0 between the arrival of a frame and the next one
+uniform float previousWeight;
 
 void main() {
-    gl_Position = projection * view * model * vec4(pos, 1.0);
-    fragPos = pos;
+
+    // samples that were not finite in the previous frame are drawn as they are now
+    vec3 blended = pos;
+    if (previousWeight > 0.0 && !isnan(previousHeight) && !isinf(previousHeight))
+        blended.z = mix(pos.z, previousHeight, previousWeight);
+
+    // non-finite samples are clipped away with the primitives they belong to, compute shader frames may be
+    // drawn with indices masked for an older frame, the clipper is given a finite position to cut towards
+    bool finite = !isnan(blended.z) && !isinf(blended.z);
+    gl_ClipDistance[0] = finite ? 0.0 : -1.0;
+    if (!finite)
+        blended.z = 0.0;
+
+    gl_Position = projection * view * model * vec4(blended, 1.0);
+    fragNormal = vec3(normal, 1.0 - abs(normal.x) - abs(normal.y));
+    fragPos = blended;
 }
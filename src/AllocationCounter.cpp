@@ -0,0 +1,65 @@
+#include "../include/AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+
+static std::atomic<size_t> allocationCount(0);
+static thread_local size_t threadAllocationCount = 0; // constant initialized, safe inside operator new
+
+size_t getAllocationCount(void) {
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+size_t getThreadAllocationCount(void) {
+    return threadAllocationCount;
+}
+
+void countAllocation(void) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    threadAllocationCount++;
+}
+
+void* operator new(size_t size) {
+    countAllocation();
+    void* memory = malloc(size ? size : 1);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+#else
+
+size_t getAllocationCount(void) {
+    return 0;
+}
+
+size_t getThreadAllocationCount(void) {
+    return 0;
+}
+
+void countAllocation(void) {}
+
+#endif
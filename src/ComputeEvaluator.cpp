@@ -0,0 +1,170 @@
+#include "../include/ComputeEvaluator.h"
+
+#include <cstring>
+
+// empty range, the keys are compared as unsigned integers, no invalid samples
+static const uint32_t emptyRange[3] = {0xFFFFFFFFu, 0u, 0u};
+
+ComputeEvaluator::ComputeEvaluator() :
+    ready(false), rangeBuffers(), invalidBuffers(), invalidSizes(), numVertices(), rangeFences(), rangeSlot(0) {}
+
+bool ComputeEvaluator::init(const char* computePath, const Expression& expression) {
+    destroy();
+
+    if (!GLAD_GL_VERSION_4_3) {
+        std::cout << "WARNING: OPENGL 4.3 UNAVAILABLE, EVALUATING THE SURFACE ON THE CPU" << std::endl;
+        return false;
+    }
+
+    this->program = Shader(computePath, expression.toGLSL());
+    int linked = 0;
+    glGetProgramiv(this->program.ID, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        std::cout << "WARNING: FAILED TO BUILD COMPUTE SHADER, EVALUATING THE SURFACE ON THE CPU" << std::endl;
+        destroy();
+        return false;
+    }
+
+    glGenBuffers(COMPUTE_RANGE_FRAMES, this->rangeBuffers);
+    glGenBuffers(COMPUTE_RANGE_FRAMES, this->invalidBuffers);
+    for (uint i = 0; i < COMPUTE_RANGE_FRAMES; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->rangeBuffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(uint32_t), NULL, GL_DYNAMIC_READ);
+    }
+
+    this->ready = true;
+    return true;
+}
+
+bool ComputeEvaluator::isReady(void) {
+    return this->ready;
+}
+
+void ComputeEvaluator::destroy(void) {
+    if (this->program.ID)
+        glDeleteProgram(this->program.ID);
+    for (uint i = 0; i < COMPUTE_RANGE_FRAMES; ++i) {
+        if (this->rangeBuffers[i])
+            glDeleteBuffers(1, &this->rangeBuffers[i]);
+        if (this->invalidBuffers[i])
+            glDeleteBuffers(1, &this->invalidBuffers[i]);
+        if (this->rangeFences[i])
+            glDeleteSync(this->rangeFences[i]);
+        this->rangeBuffers[i] = 0;
+        this->invalidBuffers[i] = 0;
+        this->invalidSizes[i] = 0;
+        this->rangeFences[i] = NULL;
+    }
+
+    this->program = Shader();
+    this->rangeSlot = 0;
+    this->ready = false;
+}
+
+void ComputeEvaluator::evaluate(GLuint buffer, size_t offset, size_t size, VertexFormat format, glm::vec2 gridOrigin, float gridInterval,
+                                uint numX, uint numY, float time) {
+
+    // the oldest range buffer, a range still unread there is older than the newest one and dropped
+    this->rangeSlot = (this->rangeSlot + 1) % COMPUTE_RANGE_FRAMES;
+    GLsync& fence = this->rangeFences[this->rangeSlot];
+    if (fence) {
+        glDeleteSync(fence);
+        fence = NULL;
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->rangeBuffers[this->rangeSlot]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(emptyRange), emptyRange);
+    bindRange();
+
+    // no invalid samples, the mask and its read back copies only grow with the grid
+    size_t numVertices = (size_t) numX * numY;
+    size_t invalidSize = (numVertices + 31) / 32 * sizeof(uint32_t);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->invalidBuffers[this->rangeSlot]);
+    if (invalidSize > this->invalidSizes[this->rangeSlot]) {
+        glBufferData(GL_SHADER_STORAGE_BUFFER, invalidSize, NULL, GL_DYNAMIC_READ);
+        this->invalidSizes[this->rangeSlot] = invalidSize;
+    }
+    this->invalidBits.reserve(invalidSize / sizeof(uint32_t));
+    this->validity.reserve(numVertices);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, invalidSize, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, COMPUTE_INVALID_BINDING, this->invalidBuffers[this->rangeSlot], 0, invalidSize);
+    this->numVertices[this->rangeSlot] = numVertices;
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, COMPUTE_VERTEX_BINDING, buffer, offset, size);
+
+    this->program.use();
+    this->program.setVec2Uniform("gridOrigin", gridOrigin);
+    this->program.setFloatUniform("gridInterval", gridInterval);
+    this->program.setIntUniform("gridNumX", numX);
+    this->program.setIntUniform("gridNumY", numY);
+    this->program.setFloatUniform("t", time);
+    this->program.setIntUniform("vertexFormat", format);
+
+    // half floats are packed in pairs, one pair per invocation
+    size_t perInvocation = (format == VERTEX_FORMAT_HALF_HEIGHT) ? 2 : 1;
+    size_t numInvocations = (numVertices + perInvocation - 1) / perInvocation;
+    glDispatchCompute((numInvocations + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE, 1, 1);
+
+    // the vertices are next read as attributes, the range by the fragment shader and, once the fence
+    // has passed, the range and the mask by readRange
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void ComputeEvaluator::bindRange(void) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMPUTE_RANGE_BINDING, this->rangeBuffers[this->rangeSlot]);
+}
+
+bool ComputeEvaluator::readRange(float& zMin, float& zMax, size_t& numInvalid, const uint8_t*& valid, bool wait) {
+
+    // dispatches finish in order, so the newest finished one makes the older ones stale
+    for (uint i = 0; i < COMPUTE_RANGE_FRAMES; ++i) {
+        uint slot = (this->rangeSlot + COMPUTE_RANGE_FRAMES - i) % COMPUTE_RANGE_FRAMES;
+        GLsync& fence = this->rangeFences[slot];
+        if (!fence)
+            continue;
+
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? COMPUTE_FENCE_TIMEOUT : 0);
+        while (wait && status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(fence, 0, COMPUTE_FENCE_TIMEOUT);
+        if (status == GL_TIMEOUT_EXPIRED)
+            continue;
+
+        uint32_t range[3];
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->rangeBuffers[slot]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(range), range);
+        for (uint j = 0; j < COMPUTE_RANGE_FRAMES; ++j) {
+            if (this->rangeFences[j])
+                glDeleteSync(this->rangeFences[j]);
+            this->rangeFences[j] = NULL;
+        }
+        numInvalid = range[2];
+
+        // the mask is only read back when there is something to mask
+        valid = NULL;
+        if (numInvalid > 0) {
+            size_t numVertices = this->numVertices[slot];
+            this->invalidBits.resize((numVertices + 31) / 32);
+            this->validity.resize(numVertices);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->invalidBuffers[slot]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, this->invalidBits.size() * sizeof(uint32_t), this->invalidBits.data());
+            for (size_t k = 0; k < numVertices; ++k)
+                this->validity[k] = !((this->invalidBits[k / 32] >> (k % 32)) & 1);
+            valid = this->validity.data();
+        }
+
+        // no sample was finite, the CPU leaves its initial range in that case too
+        if (range[0] == emptyRange[0] && range[1] == emptyRange[1]) {
+            zMin = FLOAT_MAX;
+            zMax = FLOAT_MIN;
+            return true;
+        }
+
+        // inverse of orderedKey in computeShader.cs
+        for (int k = 0; k < 2; ++k)
+            range[k] = (range[k] & 0x80000000u) ? (range[k] & 0x7FFFFFFFu) : ~range[k];
+        memcpy(&zMin, &range[0], sizeof(float));
+        memcpy(&zMax, &range[1], sizeof(float));
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,1059 @@
+#include "../include/Expression.h"
+#include "../include/VectorMath.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define BLOCK_SIZE 128 // batch elements per register, 64 registers fit in 32 KB
+
+// function names recognized by the parser
+static const struct {
+    const char* name;
+    Opcode op;
+} functions[] = {
+    {"abs", OP_ABS}, {"sqrt", OP_SQRT}, {"exp", OP_EXP}, {"log", OP_LOG}, {"ln", OP_LOG},
+    {"sin", OP_SIN}, {"cos", OP_COS}, {"tan", OP_TAN},
+    {"asin", OP_ASIN}, {"acos", OP_ACOS}, {"atan", OP_ATAN},
+    {"sinh", OP_SINH}, {"cosh", OP_COSH}, {"tanh", OP_TANH}
+};
+
+// scalar semantics of every operation, shared by constant folding and the interpreter
+static inline float apply(Opcode op, float a, float b) {
+    switch (op) {
+        case OP_ADD:  return a + b;
+        case OP_SUB:  return a - b;
+        case OP_MUL:  return a * b;
+        case OP_DIV:  return a / b;
+        case OP_POW:  return std::pow(a, b);
+        case OP_NEG:  return -a;
+        case OP_ABS:  return std::fabs(a);
+        case OP_SQRT: return std::sqrt(a);
+        case OP_EXP:  return std::exp(a);
+        case OP_LOG:  return std::log(a);
+        case OP_SIN:  return std::sin(a);
+        case OP_COS:  return std::cos(a);
+        case OP_TAN:  return std::tan(a);
+        case OP_ASIN: return std::asin(a);
+        case OP_ACOS: return std::acos(a);
+        case OP_ATAN: return std::atan(a);
+        case OP_SINH: return std::sinh(a);
+        case OP_COSH: return std::cosh(a);
+        case OP_TANH: return std::tanh(a);
+        default:      return 0.0f;
+    }
+}
+
+static inline bool isLeaf(Opcode op) {
+    return op <= OP_T;
+}
+
+// default constructor, evaluates to 0 until a function is parsed
+Expression::Expression() :
+    root(-1), gradientRoots{-1, -1}, symmetry(SYMMETRY_NONE), timeDependent(false), numRegisters(3), outputRegister(0),
+    gradientRegisters(), pos(0) {}
+
+bool Expression::parse(const std::string& source) {
+
+    // reset state
+    this->source = source;
+    this->error.clear();
+    this->nodes.clear();
+    this->nodeLookup.clear();
+    this->code.clear();
+    this->root = -1;
+    this->gradientRoots[0] = -1;
+    this->gradientRoots[1] = -1;
+    this->symmetry = SYMMETRY_NONE;
+    this->timeDependent = false;
+    this->pos = 0;
+
+    // build expression tree
+    int node = parseSum();
+    if (node < 0)
+        return false;
+
+    skipWhitespace();
+    if (this->pos != this->source.size()) {
+        fail(std::string("unexpected '") + this->source[this->pos] + "'");
+        return false;
+    }
+
+    this->root = node;
+
+    // generate bytecode
+    if (!compile()) {
+        this->root = -1;
+        return false;
+    }
+
+    this->symmetry = findSymmetry();
+    return true;
+}
+
+float Expression::evaluate(float x, float y, float t) const {
+
+    if (this->root < 0)
+        return 0.0f;
+
+    // load constants and variables into registers
+    float regs[MAX_REGISTERS];
+    memcpy(regs, this->initialRegisters.data(), this->numRegisters * sizeof(float));
+    regs[0] = x;
+    regs[1] = y;
+    regs[2] = t;
+
+    // interpreter loop
+    for (const Instruction& in : this->code)
+        regs[in.dst] = apply(in.op, regs[in.a], regs[in.b]);
+
+    return regs[this->outputRegister];
+}
+
+void Expression::evaluateRow(const float* xs, float y, float t, float* zOut, size_t n) const {
+    evaluateBatch(0, xs, 0.0f, y, t, zOut, NULL, NULL, n);
+}
+
+void Expression::evaluateColumn(float x, const float* ys, float t, float* zOut, size_t n) const {
+    evaluateBatch(1, ys, x, 0.0f, t, zOut, NULL, NULL, n);
+}
+
+void Expression::evaluateGradientRow(const float* xs, float y, float t, float* zOut, float* dzdxOut, float* dzdyOut, size_t n) const {
+    evaluateBatch(0, xs, 0.0f, y, t, zOut, dzdxOut, dzdyOut, n);
+}
+
+void Expression::evaluateGradientColumn(float x, const float* ys, float t, float* zOut, float* dzdxOut, float* dzdyOut, size_t n) const {
+    evaluateBatch(1, ys, x, 0.0f, t, zOut, dzdxOut, dzdyOut, n);
+}
+
+void Expression::evaluateBatch(uint varying, const float* values, float x, float y, float t, float* zOut, float* dzdxOut, float* dzdyOut,
+                               size_t n) const {
+
+    // an expression that was not differentiated has no slope
+    float* outputs[3] = {zOut, dzdxOut, dzdyOut};
+    uint outputRegisters[3] = {this->outputRegister, this->gradientRegisters[0], this->gradientRegisters[1]};
+    for (int k = 0; k < 3; ++k) {
+        if (outputs[k] && (this->root < 0 || (k > 0 && this->gradientRoots[k - 1] < 0))) {
+            memset(outputs[k], 0, n * sizeof(float));
+            outputs[k] = NULL;
+        }
+    }
+    if (!outputs[0] && !outputs[1] && !outputs[2])
+        return;
+
+    const VectorMath& vm = getVectorMath();
+
+    // every register is a block of lanes, uniform registers are broadcast once per call
+    alignas(32) float scratch[MAX_REGISTERS * BLOCK_SIZE];
+    float* regs[MAX_REGISTERS];
+    for (uint r = 0; r < this->numRegisters; ++r) {
+        regs[r] = scratch + r * BLOCK_SIZE;
+        float value = (r == 0) ? x : (r == 1) ? y : (r == 2) ? t : this->initialRegisters[r];
+        std::fill(regs[r], regs[r] + BLOCK_SIZE, value);
+    }
+
+    // output registers keep their values once written, so a register computed by an instruction can write
+    // straight to its output, leaves and outputs sharing a register are copied
+    bool written[MAX_REGISTERS] = {false};
+    for (const Instruction& in : this->code)
+        written[in.dst] = true;
+    bool aliased[3] = {false, false, false};
+    for (int k = 0; k < 3; ++k) {
+        uint r = outputRegisters[k];
+        if (outputs[k] && written[r]) {
+            aliased[k] = true;
+            written[r] = false;
+        }
+    }
+
+    for (size_t start = 0; start < n; start += BLOCK_SIZE) {
+        size_t count = std::min((size_t) BLOCK_SIZE, n - start);
+
+        // the varying input is read in place, instructions never write input registers
+        regs[varying] = const_cast<float*>(values + start);
+        for (int k = 0; k < 3; ++k)
+            if (aliased[k])
+                regs[outputRegisters[k]] = outputs[k] + start;
+
+        for (const Instruction& in : this->code)
+            vm.ops[in.op](regs[in.dst], regs[in.a], regs[in.b], count);
+
+        for (int k = 0; k < 3; ++k)
+            if (outputs[k] && !aliased[k])
+                memcpy(outputs[k] + start, regs[outputRegisters[k]], count * sizeof(float));
+    }
+}
+
+Symmetry Expression::getSymmetry(void) const {
+    return this->symmetry;
+}
+
+bool Expression::dependsOnTime(void) const {
+    return this->timeDependent;
+}
+
+bool Expression::isValid(void) const {
+    return this->root >= 0;
+}
+
+bool Expression::hasGradient(void) const {
+    return this->root >= 0 && this->gradientRoots[0] >= 0;
+}
+
+const std::string& Expression::getSource(void) const {
+    return this->source;
+}
+
+const std::string& Expression::getError(void) const {
+    return this->error;
+}
+
+uint Expression::getNumInstructions(void) const {
+    return this->code.size();
+}
+
+uint Expression::getNumRegisters(void) const {
+    return this->numRegisters;
+}
+
+// PARSER
+//
+// sum     := product (('+' | '-') product)*
+// product := unary (('*' | '/') unary)*
+// unary   := ('-' | '+') unary | power
+// power   := primary ('^' unary)?
+// primary := number | variable | constant | function '(' sum ')' | '(' sum ')'
+
+int Expression::parseSum(void) {
+    int lhs = parseProduct();
+    while (lhs >= 0) {
+        skipWhitespace();
+        if (this->pos >= this->source.size())
+            break;
+
+        char c = this->source[this->pos];
+        if (c != '+' && c != '-')
+            break;
+        this->pos++;
+
+        int rhs = parseProduct();
+        if (rhs < 0)
+            return -1;
+        lhs = makeBinary(c == '+' ? OP_ADD : OP_SUB, lhs, rhs);
+    }
+    return lhs;
+}
+
+int Expression::parseProduct(void) {
+    int lhs = parseUnary();
+    while (lhs >= 0) {
+        skipWhitespace();
+        if (this->pos >= this->source.size())
+            break;
+
+        char c = this->source[this->pos];
+        if (c != '*' && c != '/')
+            break;
+        this->pos++;
+
+        int rhs = parseUnary();
+        if (rhs < 0)
+            return -1;
+        lhs = makeBinary(c == '*' ? OP_MUL : OP_DIV, lhs, rhs);
+    }
+    return lhs;
+}
+
+int Expression::parseUnary(void) {
+    skipWhitespace();
+    if (this->pos < this->source.size()) {
+        char c = this->source[this->pos];
+        if (c == '-' || c == '+') {
+            this->pos++;
+            int operand = parseUnary();
+            if (operand < 0)
+                return -1;
+            return (c == '-') ? makeUnary(OP_NEG, operand) : operand;
+        }
+    }
+    return parsePower();
+}
+
+int Expression::parsePower(void) {
+    int base = parsePrimary();
+    if (base < 0)
+        return -1;
+
+    skipWhitespace();
+    if (this->pos < this->source.size() && this->source[this->pos] == '^') {
+        this->pos++;
+        int exponent = parseUnary(); // right associative
+        if (exponent < 0)
+            return -1;
+        return makeBinary(OP_POW, base, exponent);
+    }
+    return base;
+}
+
+int Expression::parsePrimary(void) {
+    skipWhitespace();
+    if (this->pos >= this->source.size())
+        return fail("unexpected end of expression");
+
+    const char* start = this->source.c_str() + this->pos;
+    char c = *start;
+
+    // number
+    if (isdigit(c) || c == '.') {
+        char* end;
+        float value = strtof(start, &end);
+        if (end == start)
+            return fail("invalid number");
+        this->pos += end - start;
+        return makeConstant(value);
+    }
+
+    // parenthesized subexpression
+    if (c == '(') {
+        this->pos++;
+        int node = parseSum();
+        if (node < 0)
+            return -1;
+        skipWhitespace();
+        if (this->pos >= this->source.size() || this->source[this->pos] != ')')
+            return fail("expected ')'");
+        this->pos++;
+        return node;
+    }
+
+    // identifier
+    if (isalpha(c) || c == '_') {
+        size_t begin = this->pos;
+        while (this->pos < this->source.size() && (isalnum(this->source[this->pos]) || this->source[this->pos] == '_'))
+            this->pos++;
+        std::string name = this->source.substr(begin, this->pos - begin);
+
+        if (name == "x")
+            return addNode(OP_X);
+        if (name == "y")
+            return addNode(OP_Y);
+        if (name == "t")
+            return addNode(OP_T);
+        if (name == "pi")
+            return makeConstant(3.14159265f);
+        if (name == "e")
+            return makeConstant(2.71828183f);
+
+        for (const auto& function : functions) {
+            if (name != function.name)
+                continue;
+
+            skipWhitespace();
+            if (this->pos >= this->source.size() || this->source[this->pos] != '(')
+                return fail("expected '(' after " + name);
+            this->pos++;
+            int argument = parseSum();
+            if (argument < 0)
+                return -1;
+            skipWhitespace();
+            if (this->pos >= this->source.size() || this->source[this->pos] != ')')
+                return fail("expected ')'");
+            this->pos++;
+            return makeUnary(function.op, argument);
+        }
+
+        this->pos = begin;
+        return fail("unknown identifier '" + name + "'");
+    }
+
+    return fail(std::string("unexpected '") + c + "'");
+}
+
+void Expression::skipWhitespace(void) {
+    while (this->pos < this->source.size() && isspace(this->source[this->pos]))
+        this->pos++;
+}
+
+int Expression::fail(const std::string& message) {
+    this->error = message + " at position " + std::to_string(this->pos);
+    return -1;
+}
+
+// TREE CONSTRUCTION
+
+int Expression::addNode(Opcode op, int a, int b, float value) {
+
+    // reuse an identical node if one exists, constants are compared bitwise so NaN and -0 stay distinct
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    std::tuple<int, int, int, uint32_t> key(op, a, b, bits);
+    auto it = this->nodeLookup.find(key);
+    if (it != this->nodeLookup.end())
+        return it->second;
+
+    this->nodes.push_back({op, a, b, value});
+    int index = this->nodes.size() - 1;
+    this->nodeLookup[key] = index;
+    return index;
+}
+
+int Expression::makeConstant(float value) {
+    return addNode(OP_CONST, -1, -1, value);
+}
+
+int Expression::makeUnary(Opcode op, int a) {
+
+    // constant folding
+    if (this->nodes[a].op == OP_CONST)
+        return makeConstant(apply(op, this->nodes[a].value, 0.0f));
+
+    // -(-a) = a
+    if (op == OP_NEG && this->nodes[a].op == OP_NEG)
+        return this->nodes[a].a;
+
+    return addNode(op, a);
+}
+
+int Expression::makeBinary(Opcode op, int a, int b) {
+    bool constA = this->nodes[a].op == OP_CONST;
+    bool constB = this->nodes[b].op == OP_CONST;
+
+    // constant folding
+    if (constA && constB)
+        return makeConstant(apply(op, this->nodes[a].value, this->nodes[b].value));
+
+    // strength reduction of small constant powers
+    if (op == OP_POW && constB) {
+        float exponent = this->nodes[b].value;
+        if (exponent == 1.0f)
+            return a;
+        if (exponent == 2.0f)
+            return makeBinary(OP_MUL, a, a);
+        if (exponent == 3.0f)
+            return makeBinary(OP_MUL, makeBinary(OP_MUL, a, a), a);
+        if (exponent == 4.0f) {
+            int square = makeBinary(OP_MUL, a, a);
+            return makeBinary(OP_MUL, square, square);
+        }
+        if (exponent == 0.5f)
+            return makeUnary(OP_SQRT, a);
+        if (exponent == -1.0f)
+            return makeBinary(OP_DIV, makeConstant(1.0f), a);
+    }
+
+    // identities
+    if (op == OP_ADD && constA && this->nodes[a].value == 0.0f)
+        return b;
+    if ((op == OP_ADD || op == OP_SUB) && constB && this->nodes[b].value == 0.0f)
+        return a;
+    if (op == OP_MUL && constA && this->nodes[a].value == 1.0f)
+        return b;
+    if ((op == OP_MUL || op == OP_DIV) && constB && this->nodes[b].value == 1.0f)
+        return a;
+
+    // canonical operand order for commutative operations, so a*b and b*a share a node
+    if ((op == OP_ADD || op == OP_MUL) && a > b)
+        std::swap(a, b);
+
+    return addNode(op, a, b);
+}
+
+// COMPILER
+
+std::vector<bool> Expression::findReachable(void) const {
+
+    // children always precede their parents in the node pool, so a reverse sweep finds reachable nodes
+    std::vector<bool> reachable(this->nodes.size(), false);
+    int last = this->root;
+    reachable[this->root] = true;
+    for (int output : this->gradientRoots) {
+        if (output >= 0) {
+            reachable[output] = true;
+            last = std::max(last, output);
+        }
+    }
+    for (int i = last; i >= 0; --i) {
+        if (!reachable[i] || isLeaf(this->nodes[i].op))
+            continue;
+        reachable[this->nodes[i].a] = true;
+        if (this->nodes[i].b >= 0)
+            reachable[this->nodes[i].b] = true;
+    }
+    return reachable;
+}
+
+bool Expression::compile(void) {
+
+    int numNodes = this->nodes.size();
+    this->code.clear();
+    std::vector<bool> reachable = findReachable();
+
+    // the derivatives of a differentiated expression are compiled into the same program as z
+    int last = std::max(this->root, std::max(this->gradientRoots[0], this->gradientRoots[1]));
+
+    // last instruction reading each node, after which its register can be recycled, outputs are never recycled
+    std::vector<int> lastUse(numNodes, -1);
+    for (int i = 0; i <= last; ++i) {
+        if (!reachable[i] || isLeaf(this->nodes[i].op))
+            continue;
+        lastUse[this->nodes[i].a] = i;
+        if (this->nodes[i].b >= 0)
+            lastUse[this->nodes[i].b] = i;
+    }
+    lastUse[this->root] = numNodes;
+    for (int output : this->gradientRoots)
+        if (output >= 0)
+            lastUse[output] = numNodes;
+
+    // registers 0, 1, 2 are reserved for x, y, t
+    std::vector<int> reg(numNodes, -1);
+    bool used[MAX_REGISTERS] = {true, true, true};
+    std::vector<std::pair<int, float>> constants;
+
+    auto allocate = [&used](void) {
+        for (int r = 0; r < MAX_REGISTERS; ++r) {
+            if (!used[r]) {
+                used[r] = true;
+                return r;
+            }
+        }
+        return -1;
+    };
+
+    // leaves keep their registers for the whole program
+    for (int i = 0; i <= last; ++i) {
+        if (!reachable[i])
+            continue;
+        switch (this->nodes[i].op) {
+            case OP_X: reg[i] = 0; break;
+            case OP_Y: reg[i] = 1; break;
+            case OP_T: reg[i] = 2; break;
+            case OP_CONST:
+                reg[i] = allocate();
+                if (reg[i] < 0) {
+                    this->error = "expression has too many constants";
+                    return false;
+                }
+                constants.push_back(std::make_pair(reg[i], this->nodes[i].value));
+                break;
+            default: break;
+        }
+    }
+
+    // emit instructions, recycling operand registers at their last use
+    int highest = 2;
+    for (int i = 0; i <= last; ++i) {
+        const Node& node = this->nodes[i];
+        if (!reachable[i] || isLeaf(node.op))
+            continue;
+
+        if (lastUse[node.a] == i && !isLeaf(this->nodes[node.a].op))
+            used[reg[node.a]] = false;
+        if (node.b >= 0 && lastUse[node.b] == i && !isLeaf(this->nodes[node.b].op))
+            used[reg[node.b]] = false;
+
+        reg[i] = allocate();
+        if (reg[i] < 0) {
+            this->error = "expression is too complex";
+            return false;
+        }
+        if (reg[i] > highest)
+            highest = reg[i];
+
+        Instruction in;
+        in.op = node.op;
+        in.dst = reg[i];
+        in.a = reg[node.a];
+        in.b = (node.b >= 0) ? reg[node.b] : reg[node.a];
+        this->code.push_back(in);
+    }
+
+    for (const auto& constant : constants)
+        if (constant.first > highest)
+            highest = constant.first;
+
+    // register image loaded before every evaluation
+    this->numRegisters = highest + 1;
+    this->outputRegister = reg[this->root];
+    for (int k = 0; k < 2; ++k)
+        this->gradientRegisters[k] = (this->gradientRoots[k] >= 0) ? reg[this->gradientRoots[k]] : 0;
+    this->initialRegisters.assign(this->numRegisters, 0.0f);
+    for (const auto& constant : constants)
+        this->initialRegisters[constant.first] = constant.second;
+
+    // without t the surface is the same at every time
+    this->timeDependent = (findVariables()[this->root] & 4) != 0;
+    return true;
+}
+
+// SYMMETRY ANALYSIS
+
+float Expression::linearCoefficient(int i, Opcode variable) const {
+    const Node& node = this->nodes[i];
+    if (node.op == variable)
+        return 1.0f;
+    if (node.op == OP_NEG)
+        return -linearCoefficient(node.a, variable);
+
+    // constants are folded, so at most one operand is constant
+    if (node.op == OP_MUL && this->nodes[node.a].op == OP_CONST)
+        return this->nodes[node.a].value * linearCoefficient(node.b, variable);
+    if (node.op == OP_MUL && this->nodes[node.b].op == OP_CONST)
+        return this->nodes[node.b].value * linearCoefficient(node.a, variable);
+    if (node.op == OP_DIV && this->nodes[node.b].op == OP_CONST)
+        return linearCoefficient(node.a, variable) / this->nodes[node.b].value;
+    return 0.0f;
+}
+
+float Expression::quadraticCoefficient(int i, Opcode variable) const {
+    const Node& node = this->nodes[i];
+    if (node.op == OP_NEG)
+        return -quadraticCoefficient(node.a, variable);
+    if (node.op == OP_MUL && this->nodes[node.a].op == OP_CONST)
+        return this->nodes[node.a].value * quadraticCoefficient(node.b, variable);
+    if (node.op == OP_MUL && this->nodes[node.b].op == OP_CONST)
+        return this->nodes[node.b].value * quadraticCoefficient(node.a, variable);
+    if (node.op == OP_DIV && this->nodes[node.b].op == OP_CONST)
+        return quadraticCoefficient(node.a, variable) / this->nodes[node.b].value;
+
+    // x^2 is reduced to x*x, (x/a)^2 to (x/a)*(x/a)
+    if (node.op == OP_MUL)
+        return linearCoefficient(node.a, variable) * linearCoefficient(node.b, variable);
+    return 0.0f;
+}
+
+bool Expression::isSquaredRadius(int i) const {
+    const Node& node = this->nodes[i];
+    if (node.op != OP_ADD && node.op != OP_SUB)
+        return false;
+
+    // sums are in node order, so either operand may hold x, -x^2 - y^2 is a difference
+    float sign = (node.op == OP_SUB) ? -1.0f : 1.0f;
+    float c = quadraticCoefficient(node.a, OP_X);
+    if (c != 0.0f && c == sign * quadraticCoefficient(node.b, OP_Y))
+        return true;
+    c = quadraticCoefficient(node.a, OP_Y);
+    return c != 0.0f && c == sign * quadraticCoefficient(node.b, OP_X);
+}
+
+std::vector<uint8_t> Expression::findVariables(void) const {
+    std::vector<uint8_t> variables(this->nodes.size(), 0);
+    for (size_t i = 0; i < this->nodes.size(); ++i) {
+        const Node& node = this->nodes[i];
+        if (node.op == OP_X)
+            variables[i] = 1;
+        else if (node.op == OP_Y)
+            variables[i] = 2;
+        else if (node.op == OP_T)
+            variables[i] = 4;
+        else if (!isLeaf(node.op))
+            variables[i] = variables[node.a] | ((node.b >= 0) ? variables[node.b] : 0);
+    }
+    return variables;
+}
+
+// flattens a sum into coefficient * term pairs, constant factors are distributed over the terms
+void Expression::collectTerms(int i, float coefficient, std::vector<std::pair<int, float>>& terms) const {
+    const Node& node = this->nodes[i];
+    bool constA = !isLeaf(node.op) && this->nodes[node.a].op == OP_CONST;
+    bool constB = node.b >= 0 && this->nodes[node.b].op == OP_CONST;
+
+    if (node.op == OP_ADD || node.op == OP_SUB) {
+        collectTerms(node.a, coefficient, terms);
+        collectTerms(node.b, (node.op == OP_SUB) ? -coefficient : coefficient, terms);
+    }
+    else if (node.op == OP_NEG)
+        collectTerms(node.a, -coefficient, terms);
+    else if (node.op == OP_MUL && constA)
+        collectTerms(node.b, coefficient * this->nodes[node.a].value, terms);
+    else if (node.op == OP_MUL && constB)
+        collectTerms(node.a, coefficient * this->nodes[node.b].value, terms);
+    else if (node.op == OP_DIV && constB)
+        collectTerms(node.a, coefficient / this->nodes[node.b].value, terms);
+    else
+        terms.push_back(std::make_pair(i, coefficient));
+}
+
+// flattens a product into factor ^ exponent pairs, exponent 1 or -1 for divisors
+void Expression::collectFactors(int i, float exponent, std::vector<std::pair<int, float>>& factors) const {
+    const Node& node = this->nodes[i];
+    if (node.op == OP_MUL || node.op == OP_DIV) {
+        collectFactors(node.a, exponent, factors);
+        collectFactors(node.b, (node.op == OP_DIV) ? -exponent : exponent, factors);
+    }
+    else {
+        factors.push_back(std::make_pair(i, exponent));
+    }
+}
+
+// every operand depends on x or y but not both, and both appear
+bool Expression::isSeparable(const std::vector<std::pair<int, float>>& operands) const {
+    std::vector<uint8_t> variables = findVariables();
+    uint8_t found = 0;
+    for (const auto& operand : operands) {
+        uint8_t spatial = variables[operand.first] & 3;
+        if (spatial == 3)
+            return false;
+        found |= spatial;
+    }
+    return found == 3;
+}
+
+bool Expression::separate(Expression& g, Expression& h) const {
+    if (this->symmetry != SYMMETRY_SEPARABLE_SUM && this->symmetry != SYMMETRY_SEPARABLE_PRODUCT)
+        return false;
+
+    bool sum = this->symmetry == SYMMETRY_SEPARABLE_SUM;
+    std::vector<std::pair<int, float>> operands;
+    if (sum)
+        collectTerms(this->root, 1.0f, operands);
+    else
+        collectFactors(this->root, 1.0f, operands);
+    std::vector<uint8_t> variables = findVariables();
+
+    // both parts start from this node pool, operands depending on neither variable go to g
+    g = *this;
+    h = *this;
+    g.root = -1;
+    h.root = -1;
+    for (const auto& operand : operands) {
+        Expression& part = (variables[operand.first] & 2) ? h : g;
+        if (sum)
+            part.root = part.appendTerm(part.root, operand.first, operand.second);
+        else
+            part.root = part.appendFactor(part.root, operand.first, operand.second);
+    }
+
+    for (Expression* part : {&g, &h}) {
+        part->symmetry = SYMMETRY_NONE;
+        part->gradientRoots[0] = part->gradientRoots[1] = -1; // parts are differentiated on their own
+        if (!part->compile()) {
+            part->root = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Expression::factorTime(Expression& a, Expression& g, Expression& b) const {
+    if (this->root < 0)
+        return false;
+
+    std::vector<uint8_t> variables = findVariables();
+    if (!(variables[this->root] & 4) || !(variables[this->root] & 3))
+        return false;
+
+    // the parts start from this node pool, terms without x and y go to b
+    a = *this;
+    g = *this;
+    b = *this;
+    a.root = -1;
+    g.root = -1;
+    b.root = -1;
+
+    // every spatial term must share one time factor, the product of its factors that only depend on t
+    std::vector<std::pair<int, float>> terms;
+    std::vector<std::pair<int, float>> timeFactors;
+    bool firstTerm = true;
+    collectTerms(this->root, 1.0f, terms);
+    for (const auto& term : terms) {
+        if (!(variables[term.first] & 3)) {
+            b.root = b.appendTerm(b.root, term.first, term.second);
+            continue;
+        }
+
+        std::vector<std::pair<int, float>> factors;
+        std::vector<std::pair<int, float>> termTimeFactors;
+        int spatial = -1;
+        collectFactors(term.first, 1.0f, factors);
+        for (const auto& factor : factors) {
+            uint8_t factorVariables = variables[factor.first];
+            if ((factorVariables & 4) && (factorVariables & 3))
+                return false;
+            if (factorVariables & 4)
+                termTimeFactors.push_back(factor);
+            else
+                spatial = g.appendFactor(spatial, factor.first, factor.second);
+        }
+
+        std::sort(termTimeFactors.begin(), termTimeFactors.end());
+        if (!firstTerm && termTimeFactors != timeFactors)
+            return false;
+        timeFactors = termTimeFactors;
+        firstTerm = false;
+        g.root = g.appendTerm(g.root, spatial, term.second);
+    }
+
+    for (const auto& factor : timeFactors)
+        a.root = a.appendFactor(a.root, factor.first, factor.second);
+    if (a.root < 0)
+        a.root = a.makeConstant(1.0f);
+    if (b.root < 0)
+        b.root = b.makeConstant(0.0f);
+
+    for (Expression* part : {&a, &g, &b}) {
+        part->symmetry = SYMMETRY_NONE;
+        part->gradientRoots[0] = part->gradientRoots[1] = -1; // parts are differentiated on their own
+        if (!part->compile()) {
+            part->root = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Expression::differentiate(Expression& gradient) const {
+    if (this->root < 0)
+        return false;
+
+    // tangents of the reachable nodes in node order, children come first so each rule finds its operands' tangents
+    gradient = *this;
+    std::vector<bool> reachable = findReachable();
+    for (int k = 0; k < 2; ++k) {
+        Opcode variable = (k == 0) ? OP_X : OP_Y;
+        std::vector<int> tangents(this->root + 1, -1);
+        for (int i = 0; i <= this->root; ++i)
+            if (reachable[i])
+                tangents[i] = gradient.differentiateNode(i, variable, tangents);
+        gradient.gradientRoots[k] = tangents[this->root];
+    }
+
+    gradient.symmetry = SYMMETRY_NONE;
+    if (!gradient.compile()) {
+        gradient.root = -1;
+        return false;
+    }
+    return true;
+}
+
+int Expression::differentiateNode(int i, Opcode variable, const std::vector<int>& tangents) {
+    Node node = this->nodes[i]; // the pool grows below
+    if (node.op == OP_X || node.op == OP_Y)
+        return makeConstant(node.op == variable ? 1.0f : 0.0f);
+    if (isLeaf(node.op))
+        return makeConstant(0.0f);
+
+    // a zero tangent is structural, terms multiplied by it are left out rather than folded,
+    // so 0 * f(x) does not turn into NaN where f is not finite
+    int zero = makeConstant(0.0f);
+    int one = makeConstant(1.0f);
+    auto isZero = [this](int j) { return this->nodes[j].op == OP_CONST && this->nodes[j].value == 0.0f; };
+    auto mul = [this, &isZero, zero](int a, int b) { return (isZero(a) || isZero(b)) ? zero : makeBinary(OP_MUL, a, b); };
+    auto div = [this, &isZero, zero](int a, int b) { return isZero(a) ? zero : makeBinary(OP_DIV, a, b); };
+    auto sub = [this, &isZero](int a, int b) { return isZero(a) ? makeUnary(OP_NEG, b) : makeBinary(OP_SUB, a, b); };
+    auto add = [this](int a, int b) { return makeBinary(OP_ADD, a, b); };
+    auto neg = [this](int a) { return makeUnary(OP_NEG, a); };
+
+    int a = node.a, b = node.b;
+    int da = tangents[a];
+    int db = (b >= 0) ? tangents[b] : zero;
+    if (isZero(da) && isZero(db))
+        return zero;
+
+    // d(op(a, b)) in terms of a, b, da, db and the node itself
+    switch (node.op) {
+        case OP_ADD:  return add(da, db);
+        case OP_SUB:  return sub(da, db);
+        case OP_MUL:  return add(mul(da, b), mul(a, db));
+        case OP_DIV:  return div(sub(da, mul(i, db)), b);
+        case OP_POW: {
+            // b * a^(b - 1) * da + a^b * log(a) * db, one term drops out for a constant base or exponent
+            int base = isZero(da) ? zero : mul(mul(b, makeBinary(OP_POW, a, sub(b, one))), da);
+            int exponent = isZero(db) ? zero : mul(mul(i, makeUnary(OP_LOG, a)), db);
+            return add(base, exponent);
+        }
+        case OP_NEG:  return neg(da);
+        case OP_ABS:  return mul(div(i, a), da);
+        case OP_SQRT: return div(da, mul(makeConstant(2.0f), i));
+        case OP_EXP:  return mul(i, da);
+        case OP_LOG:  return div(da, a);
+        case OP_SIN:  return mul(makeUnary(OP_COS, a), da);
+        case OP_COS:  return neg(mul(makeUnary(OP_SIN, a), da));
+        case OP_TAN:  return mul(da, add(one, mul(i, i)));
+        case OP_ASIN: return div(da, makeUnary(OP_SQRT, sub(one, mul(a, a))));
+        case OP_ACOS: return neg(div(da, makeUnary(OP_SQRT, sub(one, mul(a, a)))));
+        case OP_ATAN: return div(da, add(one, mul(a, a)));
+        case OP_SINH: return mul(makeUnary(OP_COSH, a), da);
+        case OP_COSH: return mul(makeUnary(OP_SINH, a), da);
+        case OP_TANH: return mul(da, sub(one, mul(i, i)));
+        default:      return zero;
+    }
+}
+
+float Expression::findPeriod(void) const {
+    if (this->root < 0 || !this->timeDependent)
+        return 0.0f;
+
+    // angular frequency of every trigonometric node of t, t anywhere else is not periodic
+    std::vector<uint8_t> variables = findVariables();
+    std::vector<bool> visited(this->nodes.size(), false);
+    std::vector<float> frequencies;
+    std::vector<int> pending(1, this->root);
+    while (!pending.empty()) {
+        int i = pending.back();
+        pending.pop_back();
+        if (visited[i] || !(variables[i] & 4))
+            continue;
+        visited[i] = true;
+
+        const Node& node = this->nodes[i];
+        if (node.op == OP_T)
+            return 0.0f;
+        if (node.op != OP_SIN && node.op != OP_COS && node.op != OP_TAN) {
+            pending.push_back(node.a);
+            if (node.b >= 0)
+                pending.push_back(node.b);
+            continue;
+        }
+
+        // the argument is c*t plus terms without t
+        std::vector<std::pair<int, float>> terms;
+        collectTerms(node.a, 1.0f, terms);
+        float frequency = 0.0f;
+        for (const auto& term : terms) {
+            if (!(variables[term.first] & 4))
+                continue;
+            if (this->nodes[term.first].op != OP_T)
+                return 0.0f;
+            frequency += term.second;
+        }
+        if (frequency == 0.0f || !std::isfinite(frequency))
+            return 0.0f;
+        frequencies.push_back(std::fabs(frequency));
+    }
+
+    // 2 pi / frequency is a period of each node, the common period is the shortest multiple of the
+    // slowest node's period that is a whole number of periods of every other node
+    float slowest = *std::min_element(frequencies.begin(), frequencies.end());
+    for (int multiple = 1; multiple <= MAX_PERIOD_MULTIPLE; ++multiple) {
+        bool common = true;
+        for (float frequency : frequencies) {
+            float cycles = multiple * frequency / slowest;
+            if (std::fabs(cycles - std::round(cycles)) > PERIOD_TOLERANCE * cycles)
+                common = false;
+        }
+        if (common)
+            return 2.0f * 3.14159265f * multiple / slowest;
+    }
+    return 0.0f;
+}
+
+int Expression::appendTerm(int sum, int node, float coefficient) {
+    if (coefficient == -1.0f)
+        node = makeUnary(OP_NEG, node);
+    else if (coefficient != 1.0f)
+        node = makeBinary(OP_MUL, makeConstant(coefficient), node);
+    return (sum >= 0) ? makeBinary(OP_ADD, sum, node) : node;
+}
+
+int Expression::appendFactor(int product, int node, float exponent) {
+    if (product < 0 && exponent > 0.0f)
+        return node;
+    return makeBinary((exponent > 0.0f) ? OP_MUL : OP_DIV, (product >= 0) ? product : makeConstant(1.0f), node);
+}
+
+Symmetry Expression::findSymmetry(void) const {
+
+    // separable symmetry is exact, so it is preferred over radial symmetry
+    std::vector<std::pair<int, float>> operands;
+    collectTerms(this->root, 1.0f, operands);
+    if (isSeparable(operands))
+        return SYMMETRY_SEPARABLE_SUM;
+    operands.clear();
+    collectFactors(this->root, 1.0f, operands);
+    if (isSeparable(operands))
+        return SYMMETRY_SEPARABLE_PRODUCT;
+
+    // radially symmetric if x and y only reach the root through squared radius nodes
+    std::vector<bool> reachable = findReachable();
+    std::vector<bool> usesXY(this->nodes.size(), false);
+    bool usesRadius = false;
+    for (int i = 0; i <= this->root; ++i) {
+        const Node& node = this->nodes[i];
+        if (!reachable[i])
+            continue;
+        if (node.op == OP_X || node.op == OP_Y) {
+            usesXY[i] = true;
+            continue;
+        }
+        if (isLeaf(node.op))
+            continue;
+        if (isSquaredRadius(i)) {
+            usesRadius = true;
+            continue;
+        }
+        usesXY[i] = usesXY[node.a] || (node.b >= 0 && usesXY[node.b]);
+    }
+
+    if (usesRadius && !usesXY[this->root])
+        return SYMMETRY_RADIAL;
+    return SYMMETRY_NONE;
+}
+
+// GLSL
+
+std::string Expression::toGLSL(void) const {
+    std::string code = "float f(float x, float y, float t) {\n";
+    if (this->root < 0)
+        return code + "    return 0.0;\n}\n";
+
+    // operands by name, constants inline with enough digits to round-trip
+    auto operand = [this](int i) -> std::string {
+        const Node& node = this->nodes[i];
+        char literal[32];
+        switch (node.op) {
+            case OP_X: return "x";
+            case OP_Y: return "y";
+            case OP_T: return "t";
+            case OP_CONST:
+                if (std::isnan(node.value))
+                    return "NAN";
+                if (std::isinf(node.value))
+                    return node.value > 0.0f ? "INFINITY" : "(-INFINITY)";
+                snprintf(literal, sizeof(literal), "%.9e", node.value);
+                return node.value < 0.0f ? std::string("(") + literal + ")" : std::string(literal);
+            default:
+                return "n" + std::to_string(i);
+        }
+    };
+
+    // functions without a GLSL equivalent over their whole domain call the helpers in computeShader.cs
+    std::vector<bool> reachable = findReachable();
+    for (int i = 0; i <= this->root; ++i) {
+        const Node& node = this->nodes[i];
+        if (!reachable[i] || isLeaf(node.op))
+            continue;
+
+        std::string a = operand(node.a);
+        std::string b = (node.b >= 0) ? operand(node.b) : "";
+        std::string value;
+        switch (node.op) {
+            case OP_ADD:  value = a + " + " + b; break;
+            case OP_SUB:  value = a + " - " + b; break;
+            case OP_MUL:  value = a + " * " + b; break;
+            case OP_DIV:  value = a + " / " + b; break;
+            case OP_POW:  value = "ieeePow(" + a + ", " + b + ")"; break;
+            case OP_NEG:  value = "-" + a; break;
+            case OP_ABS:  value = "abs(" + a + ")"; break;
+            case OP_SQRT: value = "ieeeSqrt(" + a + ")"; break;
+            case OP_EXP:  value = "exp(" + a + ")"; break;
+            case OP_LOG:  value = "ieeeLog(" + a + ")"; break;
+            case OP_SIN:  value = "sin(" + a + ")"; break;
+            case OP_COS:  value = "cos(" + a + ")"; break;
+            case OP_TAN:  value = "tan(" + a + ")"; break;
+            case OP_ASIN: value = "ieeeAsin(" + a + ")"; break;
+            case OP_ACOS: value = "ieeeAcos(" + a + ")"; break;
+            case OP_ATAN: value = "atan(" + a + ")"; break;
+            case OP_SINH: value = "sinh(" + a + ")"; break;
+            case OP_COSH: value = "cosh(" + a + ")"; break;
+            case OP_TANH: value = "tanh(" + a + ")"; break;
+            default:      value = "0.0"; break;
+        }
+        code += "    float n" + std::to_string(i) + " = " + value + ";\n";
+    }
+
+    return code + "    return " + operand(this->root) + ";\n}\n";
+}
@@ -0,0 +1,313 @@
+#include "../include/FrameCapture.h"
+#include "../include/ImageWriter.h"
+
+#include <cstring>
+#include <iostream>
+
+FrameCapture::FrameCapture() :
+    packBuffers(), packBufferSizes(), fences(), firstPending(0), numPending(0), stream(false), frameRate(0), recording(false),
+    numFrames(0), numScreenshots(0), screenshotRequested(false), firstJob(0), numJobs(0), stopping(false), streamFile(NULL),
+    streamWidth(0), streamHeight(0), readbackStalls(0), encoderStalls(0), failures(0) {}
+
+FrameCapture::~FrameCapture() {
+
+    // GL buffers are gone with the context by now, only the thread and the stream are left
+    stopEncoder();
+    if (this->streamFile)
+        fclose(this->streamFile);
+}
+
+bool FrameCapture::start(const std::string& pattern, int frameRate) {
+    std::string path;
+    bool stream = hasExtension(pattern, ".y4m");
+    if (!stream && !formatFramePath(pattern, 0, path))
+        return false;
+
+    // a new capture finishes the previous one
+    stop();
+
+    this->pattern = pattern;
+    this->stream = stream;
+    this->frameRate = frameRate;
+    this->numFrames = 0;
+    this->recording = true;
+    startEncoder();
+    return true;
+}
+
+void FrameCapture::setRecording(bool recording) {
+    this->recording = recording && !this->pattern.empty();
+}
+
+bool FrameCapture::isRecording(void) {
+    return this->recording;
+}
+
+void FrameCapture::requestScreenshot(void) {
+    this->screenshotRequested = true;
+    startEncoder();
+}
+
+void FrameCapture::captureFrame(int width, int height) {
+    if (this->numPending == 0 && !this->recording && !this->screenshotRequested)
+        return;
+
+    retire(false);
+    if (this->recording || this->screenshotRequested)
+        readBack(width, height);
+}
+
+bool FrameCapture::isActive(void) {
+    if (this->recording || this->screenshotRequested || this->numPending > 0)
+        return true;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->numJobs > 0;
+}
+
+void FrameCapture::stop(void) {
+    while (this->numPending > 0)
+        retire(true);
+    stopEncoder();
+
+    if (this->streamFile) {
+        fclose(this->streamFile);
+        this->streamFile = NULL;
+    }
+
+    for (int i = 0; i < CAPTURE_BUFFERS; ++i) {
+        if (this->packBuffers[i])
+            glDeleteBuffers(1, &this->packBuffers[i]);
+        this->packBuffers[i] = 0;
+        this->packBufferSizes[i] = 0;
+    }
+
+    if (this->numFrames > 0) {
+        std::cout << "captured " << this->numFrames << " frames to " << this->pattern << " (" << this->readbackStalls
+                  << " readback stalls, " << this->encoderStalls << " encoder stalls)" << std::endl;
+    }
+    if (this->failures > 0)
+        std::cout << "ERROR: FAILED TO WRITE " << this->failures << " CAPTURED FRAMES" << std::endl;
+
+    this->pattern.clear();
+    this->recording = false;
+    this->screenshotRequested = false;
+    this->numFrames = 0;
+    this->readbackStalls = 0;
+    this->encoderStalls = 0;
+    this->failures = 0;
+}
+
+void FrameCapture::startEncoder(void) {
+    if (this->encoder.joinable())
+        return;
+
+    this->stopping = false;
+    this->encoder = std::thread(&FrameCapture::encoderLoop, this);
+}
+
+void FrameCapture::stopEncoder(void) {
+    if (!this->encoder.joinable())
+        return;
+
+    // the encoder empties its queue before it exits
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->jobQueued.notify_one();
+    this->encoder.join();
+}
+
+void FrameCapture::readBack(int width, int height) {
+
+    // every buffer still in flight, the oldest has to be mapped first
+    if (this->numPending == CAPTURE_BUFFERS) {
+        this->readbackStalls++;
+        retire(true);
+    }
+
+    uint slot = (this->firstPending + this->numPending) % CAPTURE_BUFFERS;
+    CaptureJob& job = this->pending[slot];
+    job.width = width;
+    job.height = height;
+    job.toStream = this->recording && this->stream;
+
+    // a recorded image already is the screenshot
+    job.path.clear();
+    if (this->recording && !this->stream)
+        formatFramePath(this->pattern, this->numFrames, job.path);
+    if (this->screenshotRequested && job.path.empty())
+        formatFramePath(SCREENSHOT_PATTERN, this->numScreenshots++, job.path);
+    this->screenshotRequested = false;
+    if (this->recording)
+        this->numFrames++;
+
+    // RGBA is the layout drivers copy into pack buffers without converting on the CPU
+    size_t size = 4 * (size_t) width * height;
+    if (this->packBuffers[slot] == 0)
+        glGenBuffers(1, &this->packBuffers[slot]);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, this->packBuffers[slot]);
+    if (size > this->packBufferSizes[slot]) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        this->packBufferSizes[slot] = size;
+    }
+
+    // returns once the copy is queued, the fence tells when it is done
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    this->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    this->numPending++;
+}
+
+void FrameCapture::retire(bool wait) {
+    while (this->numPending > 0) {
+        uint slot = this->firstPending;
+        GLsync& fence = this->fences[slot];
+
+        // only the oldest readback is waited for
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? CAPTURE_FENCE_TIMEOUT : 0);
+        while (wait && status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(fence, 0, CAPTURE_FENCE_TIMEOUT);
+        if (status == GL_TIMEOUT_EXPIRED)
+            return;
+        wait = false;
+
+        glDeleteSync(fence);
+        fence = NULL;
+        this->firstPending = (this->firstPending + 1) % CAPTURE_BUFFERS;
+        this->numPending--;
+
+        // the queue slot after the last queued job belongs to the render thread until it is queued
+        uint queueSlot;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->numJobs == CAPTURE_QUEUE_FRAMES) {
+                this->encoderStalls++;
+                this->jobFinished.wait(lock, [this] { return this->numJobs < CAPTURE_QUEUE_FRAMES; });
+            }
+            queueSlot = (this->firstJob + this->numJobs) % CAPTURE_QUEUE_FRAMES;
+        }
+
+        const CaptureJob& frame = this->pending[slot];
+        CaptureJob& job = this->jobs[queueSlot];
+        size_t size = 4 * (size_t) frame.width * frame.height;
+        job.pixels.resize(size);
+        job.width = frame.width;
+        job.height = frame.height;
+        job.toStream = frame.toStream;
+        job.path = frame.path;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, this->packBuffers[slot]);
+        const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (pixels)
+            memcpy(job.pixels.data(), pixels, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (!pixels) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->failures++;
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->numJobs++;
+        }
+        this->jobQueued.notify_one();
+    }
+}
+
+void FrameCapture::encoderLoop(void) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->jobQueued.wait(lock, [this] { return this->numJobs > 0 || this->stopping; });
+        if (this->numJobs == 0)
+            return;
+
+        // the job stays queued while it is encoded so the render thread does not reuse it
+        CaptureJob& job = this->jobs[this->firstJob];
+        lock.unlock();
+        bool written = encode(job);
+        lock.lock();
+
+        if (!written)
+            this->failures++;
+        this->firstJob = (this->firstJob + 1) % CAPTURE_QUEUE_FRAMES;
+        this->numJobs--;
+        this->jobFinished.notify_one();
+    }
+}
+
+bool FrameCapture::encode(CaptureJob& job) {
+
+    // drop alpha in place
+    size_t numPixels = (size_t) job.width * job.height;
+    unsigned char* pixels = job.pixels.data();
+    for (size_t i = 0; i < numPixels; ++i) {
+        pixels[3 * i] = pixels[4 * i];
+        pixels[3 * i + 1] = pixels[4 * i + 1];
+        pixels[3 * i + 2] = pixels[4 * i + 2];
+    }
+
+    bool written = true;
+    if (job.toStream)
+        written = writeStreamFrame(job);
+    if (!job.path.empty())
+        written = writeImage(job.path, pixels, job.width, job.height) && written;
+    return written;
+}
+
+bool FrameCapture::writeStreamFrame(const CaptureJob& job) {
+
+    // the header is written with the first frame, every frame has its size
+    if (!this->streamFile) {
+        this->streamFile = fopen(this->pattern.c_str(), "wb");
+        if (!this->streamFile)
+            return false;
+        this->streamWidth = job.width;
+        this->streamHeight = job.height;
+        fprintf(this->streamFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", job.width, job.height, this->frameRate);
+    }
+    if (job.width != this->streamWidth || job.height != this->streamHeight)
+        return false;
+
+    // BT.601 studio range 4:2:0, top row first, chroma averaged over 2x2 pixels
+    int width = job.width, height = job.height;
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    this->yuv.resize((size_t) width * height + 2 * (size_t) chromaWidth * chromaHeight);
+    unsigned char* lumaPlane = this->yuv.data();
+    unsigned char* uPlane = lumaPlane + (size_t) width * height;
+    unsigned char* vPlane = uPlane + (size_t) chromaWidth * chromaHeight;
+    const unsigned char* pixels = job.pixels.data();
+    size_t rowSize = 3 * (size_t) width;
+
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* row = pixels + rowSize * (height - 1 - y);
+        unsigned char* luma = lumaPlane + (size_t) width * y;
+        for (int x = 0; x < width; ++x) {
+            int r = row[3 * x], g = row[3 * x + 1], b = row[3 * x + 2];
+            luma[x] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        }
+    }
+
+    for (int cy = 0; cy < chromaHeight; ++cy) {
+        const unsigned char* row0 = pixels + rowSize * (height - 1 - 2 * cy);
+        const unsigned char* row1 = (2 * cy + 1 < height) ? row0 - rowSize : row0;
+        for (int cx = 0; cx < chromaWidth; ++cx) {
+            int x0 = 2 * cx, x1 = (2 * cx + 1 < width) ? 2 * cx + 1 : 2 * cx;
+            int r = row0[3 * x0] + row0[3 * x1] + row1[3 * x0] + row1[3 * x1];
+            int g = row0[3 * x0 + 1] + row0[3 * x1 + 1] + row1[3 * x0 + 1] + row1[3 * x1 + 1];
+            int b = row0[3 * x0 + 2] + row0[3 * x1 + 2] + row1[3 * x0 + 2] + row1[3 * x1 + 2];
+
+            // sums of four pixels, hence the extra factor 4 in the shift
+            uPlane[(size_t) chromaWidth * cy + cx] = ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+            vPlane[(size_t) chromaWidth * cy + cx] = ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+        }
+    }
+
+    return fputs("FRAME\n", this->streamFile) >= 0 && fwrite(this->yuv.data(), 1, this->yuv.size(), this->streamFile) == this->yuv.size();
+}
@@ -1,10 +1,74 @@
 #include "../include/GLProgram.h"
 #include "glm/ext.hpp"
+#include "../include/AllocationCounter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 
 GLProgram::GLProgram() :
-    deltaTime(0.0f), prevTime(0.0f) {}
+    headless(false), deltaTime(0.0f), prevTime(0.0f), async(true), surfaceProducer(surfacePlotter), vertexFormat(VERTEX_FORMAT_FULL),
+    surfaceStyle(STYLE_WIREFRAME), gridLineWidth(GRID_LINE_WIDTH), drawnFrame(0), surfacePlotUploaded(false), unsettledFrames(WARMUP_FRAMES),
+    timing(false), phaseTimes(), timedFrames(0), producedFrames(0), producerTime(0.0), timingStart(0.0), onDemand(false), compute(false),
+    computeCheck(false), checkedFrames(0), checkMismatches(0),
+    checkMaxError(0.0), streaming(true), streamVBO(0), streamMemory(NULL), streamRegionSize(0), streamRegion(0),
+    streamFences(), interpolate(false), previousFrame(), latestFrame(), arrivalTime(0.0) {}
+
+void GLProgram::init(const char* vertexPath, const char* heightVertexPath, const char* fragmentPath, const char* whiteFragmentPath,
+                     const char* computePath) {
+
+    // OpenGL context, onscreen or offscreen
+    if (this->headless)
+        initHeadless();
+    else
+        initWindow();
+
+    // persistent mapping needs glBufferStorage
+    if (this->streaming && !GLAD_GL_VERSION_4_4) {
+        std::cout << "WARNING: OPENGL 4.4 UNAVAILABLE, STREAMING VERTICES WITH glBufferData" << std::endl;
+        this->streaming = false;
+    }
+
+    // GL calls
+    glViewport(0, 0, this->windowWidth, this->windowHeight);
+    glEnable(GL_DEPTH_TEST);
 
-void GLProgram::init(const char* vertexPath, const char* fragmentPath, const char* whiteFragmentPath) {
+    // triangle strips of the filled surface end at restart indices and sit behind the wireframe drawn over them
+    glEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(PRIMITIVE_RESTART_INDEX);
+    glPolygonOffset(1.0f, 1.0f);
+
+    // init shaders
+    this->shader = Shader(vertexPath, fragmentPath);
+    this->heightShader = Shader(heightVertexPath, fragmentPath);
+    this->whiteShader = Shader(vertexPath, whiteFragmentPath);
+
+    // the compute shader runs on the render thread, so frames are no longer produced asynchronously
+    if (this->compute) {
+        if (this->surfacePlotter.getNativeFunction())
+            std::cout << "WARNING: NATIVE FUNCTIONS ARE EVALUATED ON THE CPU" << std::endl;
+        else if (this->computeEvaluator.init(computePath, this->surfacePlotter.getExpression())) {
+            this->async = false;
+            setSurfaceStyle(this->surfaceStyle);
+        }
+    }
+
+    // generate default surface plot
+    this->surfacePlotter.generateSurfacePlot(1.0f);
+
+    // set up VAOs and VBOs and EBOs
+    initDrawingData();
+
+    // from here on the producer thread owns the surface plotter, its first frame is uploaded like any new one
+    if (this->async) {
+        this->surfaceProducer.start(glfwGetTime, glfwPostEmptyEvent);
+        this->drawnFrame = 0;
+    }
+}
+
+void GLProgram::initWindow(void) {
 
     // initialize window system
     glfwInit();
@@ -26,32 +90,44 @@ void GLProgram::init(const char* vertexPath, const char* fragmentPath, const cha
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR);
     glfwSetMouseButtonCallback(window, mouseButtonCallback);
     glfwSetCursorPosCallback(window, cursorPosCallback);
+    glfwSetKeyCallback(window, keyCallback);
+    glfwSetWindowUserPointer(window, this);
 
     // initialize GLAD before making OpenGL calls
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         std::cout << "FAILED TO INITIALIZE GLAD" << std::endl;
         exit(-1);
     }
+}
 
-    // GL calls
-    glViewport(0, 0, this->windowWidth, this->windowHeight);
-    glEnable(GL_DEPTH_TEST);
+void GLProgram::initHeadless(void) {
 
-    // init shaders
-    this->shader = Shader(vertexPath, fragmentPath);
-    this->whiteShader = Shader(vertexPath, whiteFragmentPath);
+    // frames are generated synchronously at the requested times
+    this->async = false;
 
-    // generate default surface plot
-    this->surfacePlotter.generateSurfacePlot(1.0f);
+    if (!this->headlessContext.create()) {
+        this->headlessContext.destroy();
+        exit(-1);
+    }
 
-    // set up VAOs and VBOs and EBOs
-    initDrawingData();
+    if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::getProcAddress)) {
+        std::cout << "FAILED TO INITIALIZE GLAD" << std::endl;
+        this->headlessContext.destroy();
+        exit(-1);
+    }
+
+    if (!this->headlessContext.createFramebuffer(this->windowWidth, this->windowHeight)) {
+        this->headlessContext.destroy();
+        exit(-1);
+    }
 }
 
-void GLProgram::run(void) {
+bool GLProgram::run(void) {
 
     // main loop
     while (!glfwWindowShouldClose(this->window)) {
+        size_t allocations = getThreadAllocationCount();
+        bool capturing = this->frameCapture.isActive();
 
         // per-frame time logic
         float currTime = glfwGetTime();
@@ -59,39 +135,172 @@ void GLProgram::run(void) {
         this->prevTime = currTime;
 
         // input
+        double phaseStart = glfwGetTime();
         processInput();
 
         glClearColor(this->clearColor.r, this->clearColor.g, this->clearColor.b, this->clearColor.alpha);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        endPhase(PHASE_INPUT, phaseStart);
 
-        // computation
-        surfacePlotter.generateSurfacePlot(1.0f);
-
-        // set up shader and transformation matrices
-        // TODO: condense this part
-        glm::mat4 viewMatrix = getViewMatrix();
-        glm::mat4 projectionMatrix = getProjectionMatrix();
-        int zRange = this->surfacePlotter.getZRange();
-        this->shader.use();
-        this->shader.setFloatUniform("zRange", (zRange == 0) ? 1.0f : zRange);
-        this->shader.setFloatUniform("zMin", this->surfacePlotter.getZMin());
-        this->shader.setMat4Uniform("view", viewMatrix);
-        this->shader.setMat4Uniform("projection", projectionMatrix);
-        this->shader.setMat4Uniform("model", getDefaultModelMatrix() * modelMatrix);
-        this->whiteShader.use();
-        this->whiteShader.setMat4Uniform("view", viewMatrix);
-        this->whiteShader.setMat4Uniform("projection", projectionMatrix);
-        this->whiteShader.setMat4Uniform("model", getDefaultModelMatrix() * modelMatrix);
+        // computation, evaluated once per frame at the time sampled above, a static surface
+        // already in the vertex buffer is drawn again from the same region
+        if (!this->async && !(this->surfacePlotUploaded && this->surfacePlotter.isCurrent(currTime))) {
+            if (char* region = beginStreamFrame(this->surfacePlotter.getVertexDataSize()))
+                this->surfacePlotter.setVertexTarget(region);
+        }
+        const SurfaceFrame& surface = this->async ? this->surfaceProducer.acquireFrame() : generateFrame(currTime);
+        bool newFrame = surface.id != this->drawnFrame;
+        endPhase(PHASE_GENERATE, phaseStart);
+
+        // uniforms
+        setSurfaceUniforms(surface);
+        endPhase(PHASE_UNIFORMS, phaseStart);
 
         // render
-        this->surfacePlotter.generateSurfacePlot((float)glfwGetTime());
-        drawSurfacePlot();
-        drawCube();
+        drawSurfacePlot(surface);
+        drawCube(surface);
+        endPhase(PHASE_DRAW, phaseStart);
+
+        // read back the back buffer before it is swapped
+        this->frameCapture.captureFrame(this->windowWidth, this->windowHeight);
+        endPhase(PHASE_CAPTURE, phaseStart);
 
         // check and call events and swap buffers
         glfwSwapBuffers((this->window));
-        glfwPollEvents();
+        endPhase(PHASE_SWAP, phaseStart);
+
+        // sleep until there is input, the time asleep counts neither as a phase nor as camera movement
+        if (isIdle()) {
+            glfwWaitEvents();
+            this->prevTime = glfwGetTime();
+            phaseStart = this->prevTime;
+        }
+        else {
+            glfwPollEvents();
+        }
+        endPhase(PHASE_SWAP, phaseStart);
+
+        if (this->timing)
+            reportTiming(surface, newFrame);
+
+        // capturing formats frame paths and fills the encoder queue on this thread
+        if (capturing || this->frameCapture.isActive())
+            this->unsettledFrames = WARMUP_FRAMES;
+
+        // once every frame buffer has been filled in the requested format, frames must not touch the heap from
+        // the render thread, the producer and the thread pool keep their own counts (debug builds only)
+        if (this->unsettledFrames == 0)
+            assert(getThreadAllocationCount() == allocations);
+        else if (newFrame && surface.format == this->vertexFormat && surface.topology == getStyleTopology(this->surfaceStyle))
+            this->unsettledFrames--;
+    }
+
+    return reportComputeCheck();
+}
+
+bool GLProgram::renderFrames(const std::vector<float>& times, const std::string& outputPattern, int frameRate) {
+    if (!this->frameCapture.start(outputPattern, frameRate)) {
+        std::cout << "ERROR: INVALID OUTPUT PATTERN: " << outputPattern << std::endl;
+        return false;
+    }
+
+    // the window system's clock is not available offscreen
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+
+    for (float time : times) {
+        glClearColor(this->clearColor.r, this->clearColor.g, this->clearColor.b, this->clearColor.alpha);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // the same steps as a frame of the render loop, at the requested time
+        if (!(this->surfacePlotUploaded && this->surfacePlotter.isCurrent(time))) {
+            if (char* region = beginStreamFrame(this->surfacePlotter.getVertexDataSize()))
+                this->surfacePlotter.setVertexTarget(region);
+        }
+        const SurfaceFrame& surface = generateFrame(time);
+        setSurfaceUniforms(surface);
+        drawSurfacePlot(surface);
+        drawCube(surface);
+
+        // read back while the following frames render
+        this->headlessContext.resolve();
+        this->frameCapture.captureFrame(this->windowWidth, this->windowHeight);
     }
+
+    // throughput including the last readbacks and disk writes
+    this->frameCapture.stop();
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    std::cout << "rendered " << times.size() << " frames of " << this->windowWidth << "x" << this->windowHeight
+              << " in " << seconds << " s: " << times.size() / seconds << " fps" << std::endl;
+    return reportComputeCheck();
+}
+
+void GLProgram::setSurfaceUniforms(const SurfaceFrame& surface) {
+
+    // transformation matrices, one write shared by every program
+    CameraUniforms cameraUniforms;
+    cameraUniforms.model = getDefaultModelMatrix() * modelMatrix;
+    cameraUniforms.view = getViewMatrix();
+    cameraUniforms.projection = getProjectionMatrix();
+    glBindBuffer(GL_UNIFORM_BUFFER, this->cameraUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(cameraUniforms), &cameraUniforms);
+
+    // surface uniforms, the z range comes from the frame being drawn, or from the range buffer the compute
+    // shader wrote it to
+    float zRange = surface.zMax - surface.zMin;
+    Shader& surfacePlotShader = getSurfacePlotShader(surface.format);
+    surfacePlotShader.use();
+    surfacePlotShader.setFloatUniform("zRange", (zRange == 0) ? 1.0f : zRange);
+    surfacePlotShader.setFloatUniform("zMin", surface.zMin);
+    surfacePlotShader.setIntUniform("computedRange", surface.gpuVertices);
+    if (surface.gpuVertices)
+        this->computeEvaluator.bindRange();
+    surfacePlotShader.setVec2Uniform("gridOrigin", this->surfacePlotter.getGridOrigin());
+    surfacePlotShader.setFloatUniform("gridInterval", this->surfacePlotter.getGridInterval());
+    if (surface.format != VERTEX_FORMAT_FULL)
+        surfacePlotShader.setIntUniform("gridNumY", this->surfacePlotter.getNumY());
+}
+
+void GLProgram::endPhase(FramePhase phase, double& phaseStart) {
+    if (!this->timing)
+        return;
+
+    double now = glfwGetTime();
+    this->phaseTimes[phase] += now - phaseStart;
+    phaseStart = now;
+}
+
+void GLProgram::reportTiming(const SurfaceFrame& frame, bool newFrame) {
+    this->timedFrames++;
+    if (newFrame) {
+        this->producedFrames++;
+        this->producerTime += frame.generateTime;
+    }
+
+    double now = glfwGetTime();
+    if (now - this->timingStart < TIMING_INTERVAL)
+        return;
+
+    // average milliseconds per frame of each phase
+    static const char* phaseNames[NUM_PHASES] = {"input", "generate", "uniforms", "draw", "capture", "swap"};
+    double total = 0.0;
+    std::cout << "frame timing (" << this->timedFrames << " frames):";
+    for (int phase = 0; phase < NUM_PHASES; ++phase) {
+        std::cout << " " << phaseNames[phase] << " " << 1000.0 * this->phaseTimes[phase] / this->timedFrames;
+        total += this->phaseTimes[phase];
+        this->phaseTimes[phase] = 0.0;
+    }
+    std::cout << ", total " << 1000.0 * total / this->timedFrames << " ms";
+    if (frame.numInvalid > 0)
+        std::cout << ", " << frame.numInvalid << " non-finite samples";
+    if (this->async && this->producedFrames > 0)
+        std::cout << ", producer " << 1000.0 * this->producerTime / this->producedFrames << " ms (" << this->producedFrames << " frames)";
+    std::cout << std::endl;
+
+    this->timedFrames = 0;
+    this->producedFrames = 0;
+    this->producerTime = 0.0;
+    this->timingStart = now;
 }
 
 void GLProgram::initDrawingData(void) {
@@ -107,14 +316,14 @@ void GLProgram::initDrawingData(void) {
 
     // set VBO data
     glBindBuffer(GL_ARRAY_BUFFER, this->surfacePlotVBO);
-    glBufferData(GL_ARRAY_BUFFER, this->surfacePlotter.getNumElements()*sizeof(float), this->surfacePlotter.getVertices(), GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, this->surfacePlotter.getVertexDataSize(), this->surfacePlotter.getVertexData(), GL_DYNAMIC_DRAW);
 
     // set EBO data
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->surfacePlotEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->surfacePlotter.getNumIndices()*sizeof(uint), this->surfacePlotter.getIndices(), GL_DYNAMIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->surfacePlotter.getNumIndices()*sizeof(uint), this->surfacePlotter.getIndices(), GL_STATIC_DRAW);
 
     // vertices attributes
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    setSurfacePlotAttributes(this->surfacePlotter.getVertexFormat(), 0);
     glEnableVertexAttribArray(0);
 
 
@@ -129,7 +338,7 @@ void GLProgram::initDrawingData(void) {
 
     // set VBO data
     glBindBuffer(GL_ARRAY_BUFFER, this->cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, 24*sizeof(float), this->surfacePlotter.getCubeVertices(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, 24*sizeof(float), this->surfacePlotter.getCubeVertices(), GL_DYNAMIC_DRAW);
 
     // set EBO data
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->cubeEBO);
@@ -140,29 +349,427 @@ void GLProgram::initDrawingData(void) {
     glEnableVertexAttribArray(0);
 
     glBindVertexArray(0);
+
+
+    // CAMERA
+
+    // glm matrices are column-major with no padding, as std140 lays out mat4
+    this->cameraUBO = generateBuffer();
+    glBindBuffer(GL_UNIFORM_BUFFER, this->cameraUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UBO_BINDING, this->cameraUBO);
+
+    // everything above is now on the GPU, but the stream regions are still to be written
+    this->syncFrame.capture(this->surfacePlotter, this->syncFrame.id + 1);
+    this->drawnFrame = this->syncFrame.id;
+    this->surfacePlotUploaded = !this->streaming;
+}
+
+void GLProgram::setSurfacePlotAttributes(VertexFormat format, size_t offset) {
+
+    // expects the surface plot VAO and the vertex buffer to be bound
+    if (format == VERTEX_FORMAT_FULL)
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+    else if (format == VERTEX_FORMAT_HEIGHT)
+        glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+    else
+        glVertexAttribPointer(0, 1, GL_HALF_FLOAT, GL_FALSE, 0, (void*)offset);
+}
+
+char* GLProgram::beginStreamFrame(size_t size) {
+    if (!this->streaming)
+        return NULL;
+
+    // grow the ring when a frame no longer fits in a region
+    if (size > this->streamRegionSize)
+        createStreamBuffer(size);
+    if (!this->streaming)
+        return NULL;
+
+    // next region, the GPU may still be drawing the frame written there STREAM_REGIONS frames ago
+    this->streamRegion = (this->streamRegion + 1) % STREAM_REGIONS;
+    waitForFence(this->streamFences[this->streamRegion]);
+    return this->streamMemory + this->streamRegion * this->streamRegionSize;
+}
+
+void GLProgram::createStreamBuffer(size_t regionSize) {
+    deleteStreamBuffer();
+
+    this->streamRegionSize = (regionSize + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT * STREAM_ALIGNMENT;
+    size_t size = this->streamRegionSize * STREAM_REGIONS;
+
+    // immutable storage stays mapped for the lifetime of the buffer, coherent writes need no explicit flush
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    this->streamVBO = generateBuffer();
+    glBindBuffer(GL_ARRAY_BUFFER, this->streamVBO);
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    this->streamMemory = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+
+    if (this->streamMemory == NULL) {
+        std::cout << "WARNING: FAILED TO MAP VERTEX STREAM, STREAMING VERTICES WITH glBufferData" << std::endl;
+        setStreaming(false);
+    }
+}
+
+void GLProgram::deleteStreamBuffer(void) {
+    if (this->streamVBO == 0)
+        return;
+
+    // the GPU may still read from any region
+    for (GLsync& fence : this->streamFences)
+        waitForFence(fence);
+
+    if (this->streamMemory) {
+        glBindBuffer(GL_ARRAY_BUFFER, this->streamVBO);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &this->streamVBO);
+
+    this->streamVBO = 0;
+    this->streamMemory = NULL;
+    this->streamRegionSize = 0;
+
+    // the producer thread points the surface plotter at its own frames
+    if (!this->surfaceProducer.isRunning())
+        this->surfacePlotter.setVertexTarget(NULL);
+}
+
+void GLProgram::waitForFence(GLsync& fence) {
+    if (fence == NULL)
+        return;
+
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_FENCE_TIMEOUT);
+    while (status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(fence, 0, STREAM_FENCE_TIMEOUT);
+
+    glDeleteSync(fence);
+    fence = NULL;
+}
+
+Topology GLProgram::getStyleTopology(SurfaceStyle style) {
+    if (style == STYLE_WIREFRAME)
+        return TOPOLOGY_LINES;
+    if (style == STYLE_FILLED_WIREFRAME)
+        return TOPOLOGY_LINES_TRIANGLES;
+
+    // the grid style draws its lines in the fragment shader
+    return TOPOLOGY_TRIANGLES;
+}
+
+Shader& GLProgram::getSurfacePlotShader(VertexFormat format) {
+    return (format == VERTEX_FORMAT_FULL) ? this->shader : this->heightShader;
+}
+
+const SurfaceFrame& GLProgram::generateFrame(float time) {
+    if (this->computeEvaluator.isReady() && this->surfacePlotter.getVertexDataSize() > 0)
+        return generateComputeFrame(time);
+
+    this->surfacePlotter.generateSurfacePlot(time);
+
+    // a frame only counts as new if something changed
+    if (this->surfacePlotter.getDirtyFlags())
+        this->syncFrame.capture(this->surfacePlotter, this->syncFrame.id + 1);
+    return this->syncFrame;
+}
+
+const SurfaceFrame& GLProgram::generateComputeFrame(float time) {
+    SurfacePlotter& plotter = this->surfacePlotter;
+
+    // a static surface stays in the vertex buffer once written, only a new topology is taken, and its
+    // range once the dispatch that wrote it has finished
+    float zMin, zMax;
+    size_t numInvalid;
+    const uint8_t* valid;
+    if (this->surfacePlotUploaded && plotter.isCurrent(time)) {
+        if (this->computeEvaluator.readRange(zMin, zMax, numInvalid, valid, true))
+            plotter.setExternalRange(zMin, zMax, numInvalid, valid);
+        if (plotter.getDirtyFlags() & (DIRTY_INDICES | DIRTY_CUBE)) {
+            this->syncFrame.capture(plotter, this->syncFrame.id + 1);
+            this->syncFrame.gpuVertices = true;
+        }
+        return this->syncFrame;
+    }
+
+    // the current stream region, or the fallback buffer re-specified as a CPU upload would,
+    // in whole words for the packed half floats
+    size_t size = (plotter.getVertexDataSize() + 3) / 4 * 4;
+    GLuint buffer = this->surfacePlotVBO;
+    size_t offset = 0;
+    if (this->streaming) {
+        buffer = this->streamVBO;
+        offset = this->streamRegion * this->streamRegionSize;
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    }
+
+    this->computeEvaluator.evaluate(buffer, offset, size, plotter.getVertexFormat(), plotter.getGridOrigin(), plotter.getGridInterval(),
+                                    plotter.getNumX(), plotter.getNumY(), time);
+    plotter.setExternalSurface(time);
+
+    // the surface shaders read this frame's range from the range buffer, the cube, the counts and the masked
+    // indices take the newest range read back without waiting, a checked frame waits for its own, and the
+    // vertex shaders clip samples that turned non-finite since the mask was read
+    if (this->computeEvaluator.readRange(zMin, zMax, numInvalid, valid, this->computeCheck))
+        plotter.setExternalRange(zMin, zMax, numInvalid, valid);
+
+    this->syncFrame.capture(plotter, this->syncFrame.id + 1);
+    this->syncFrame.gpuVertices = true;
+
+    if (this->computeCheck)
+        checkComputeFrame(buffer, offset, time);
+    return this->syncFrame;
 }
 
-void GLProgram::drawSurfacePlot(void) {
-    this->shader.use();
+// binary16 to float, for comparing half height vertices
+static float halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+
+    float value;
+    if (exponent == 0)
+        value = std::ldexp((float) mantissa, -24);
+    else if (exponent == 31)
+        value = mantissa ? NAN : INFINITY;
+    else
+        value = std::ldexp((float)(mantissa | 0x400), (int) exponent - 25);
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits |= sign;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void GLProgram::checkComputeFrame(GLuint buffer, size_t offset, float time) {
+    SurfacePlotter& plotter = this->surfacePlotter;
+    VertexFormat format = plotter.getVertexFormat();
+    size_t numVertices = plotter.getNumX() * plotter.getNumY();
+    float gpuZMin = this->syncFrame.zMin, gpuZMax = this->syncFrame.zMax;
+    size_t gpuInvalid = this->syncFrame.numInvalid;
+
+    std::vector<char>& gpuData = this->checkData;
+    gpuData.resize(plotter.getVertexDataSize());
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, offset, gpuData.size(), gpuData.data());
+
+    // the same frame on the CPU, in the surface plotter's own storage, the next frame sets its target again
+    plotter.setVertexTarget(NULL);
+    plotter.generateSurfacePlot(time);
+    const char* cpuData = static_cast<const char*>(plotter.getVertexData());
+
+    // differences relative to the z range, samples that are NaN on one side only never match
+    double scale = std::max(1.0f, plotter.getZRange());
+    auto difference = [scale](float gpu, float cpu) -> double {
+        if (gpu == cpu || (std::isnan(gpu) && std::isnan(cpu)))
+            return 0.0;
+        double error = std::fabs((double) gpu - cpu) / scale;
+        return std::isnan(error) ? INFINITY : error;
+    };
+    auto check = [this](double error) {
+        if (error > COMPUTE_CHECK_TOLERANCE)
+            this->checkMismatches++;
+        if (error > this->checkMaxError)
+            this->checkMaxError = error;
+    };
+
+    for (size_t i = 0; i < numVertices; ++i) {
+        float gpu, cpu;
+        if (format == VERTEX_FORMAT_HALF_HEIGHT) {
+            uint16_t gpuHalf, cpuHalf;
+            memcpy(&gpuHalf, gpuData.data() + i * sizeof(uint16_t), sizeof(uint16_t));
+            memcpy(&cpuHalf, cpuData + i * sizeof(uint16_t), sizeof(uint16_t));
+            gpu = halfToFloat(gpuHalf);
+            cpu = halfToFloat(cpuHalf);
+        }
+        else {
+            size_t index = (format == VERTEX_FORMAT_FULL) ? 3 * i + 2 : i;
+            memcpy(&gpu, gpuData.data() + index * sizeof(float), sizeof(float));
+            memcpy(&cpu, cpuData + index * sizeof(float), sizeof(float));
+        }
+        check(difference(gpu, cpu));
+    }
+    check(difference(gpuZMin, plotter.getZMin()));
+    check(difference(gpuZMax, plotter.getZMax()));
+    if (gpuInvalid != plotter.getNumInvalid())
+        this->checkMismatches++;
+    this->checkedFrames++;
+}
+
+bool GLProgram::reportComputeCheck(void) {
+    if (!this->computeCheck || this->checkedFrames == 0)
+        return true;
+
+    std::cout << "compute check: " << this->checkedFrames << " frames, largest difference " << this->checkMaxError
+              << " of the z range, " << this->checkMismatches << " samples over " << COMPUTE_CHECK_TOLERANCE << std::endl;
+    if (this->checkMismatches > 0) {
+        std::cout << "ERROR: COMPUTE SHADER RESULTS DIFFER FROM THE CPU" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void GLProgram::drawSurfacePlot(const SurfaceFrame& frame) {
+    getSurfacePlotShader(frame.format).use();
     glBindVertexArray(this->surfacePlotVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, this->surfacePlotVBO);
-    glBufferData(GL_ARRAY_BUFFER, this->surfacePlotter.getNumElements()*sizeof(float), this->surfacePlotter.getVertices(), GL_DYNAMIC_DRAW);
-    glDrawElements(GL_LINES, this->surfacePlotter.getNumIndices(),GL_UNSIGNED_INT, 0);
+
+    // upload only frames that have not reached the GPU yet
+    bool newFrame = frame.id != this->drawnFrame;
+    bool upload = !frame.gpuVertices && ((newFrame && (frame.dirtyFlags & DIRTY_VERTICES)) || !this->surfacePlotUploaded);
+    this->surfacePlotUploaded = true;
+
+    // frames generated in the render loop are written straight into the current stream region,
+    // frames from the producer thread are copied into the next one
+    char* region = NULL;
+    if (upload && this->async) {
+
+        // the latest frame becomes the previous one, unless the ring grows and takes it along
+        bool grows = frame.vertexDataSize > this->streamRegionSize;
+        this->previousFrame = this->latestFrame;
+        this->previousFrame.valid = this->latestFrame.valid && !grows;
+        this->latestFrame.valid = false;
+        region = beginStreamFrame(frame.vertexDataSize);
+    }
+    if (region) {
+        memcpy(region, frame.vertexData, frame.vertexDataSize);
+        this->latestFrame = {true, this->streamRegion, frame.format, frame.time, frame.zMin, frame.zMax};
+        this->arrivalTime = glfwGetTime();
+    }
+
+    size_t offset = 0;
+    if (this->streaming) {
+        glBindBuffer(GL_ARRAY_BUFFER, this->streamVBO);
+        offset = this->streamRegion * this->streamRegionSize;
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, this->surfacePlotVBO);
+        if (upload)
+            glBufferData(GL_ARRAY_BUFFER, frame.vertexDataSize, frame.vertexData, GL_DYNAMIC_DRAW);
+    }
+    setSurfacePlotAttributes(frame.format, offset);
+
+    // analytic normals follow the vertices, frames without them are lit by the facets' normals
+    Shader& surfacePlotShader = getSurfacePlotShader(frame.format);
+    surfacePlotShader.setIntUniform("analyticNormals", frame.hasNormals);
+    if (frame.hasNormals) {
+        glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, 0, (void*)(offset + frame.normalOffset));
+        glEnableVertexAttribArray(2);
+    }
+    else {
+        glDisableVertexAttribArray(2);
+    }
+
+    // the previous frame's z as a second stream, the colours follow the blended z range
+    float previousWeight = getPreviousWeight();
+    surfacePlotShader.setFloatUniform("previousWeight", previousWeight);
+    if (previousWeight > 0.0f) {
+        setPreviousHeightAttribute(frame.format, this->previousFrame.region * this->streamRegionSize);
+        glEnableVertexAttribArray(1);
+
+        float zMin = frame.zMin + previousWeight * (this->previousFrame.zMin - frame.zMin);
+        float zMax = frame.zMax + previousWeight * (this->previousFrame.zMax - frame.zMax);
+        surfacePlotShader.setFloatUniform("zRange", (zMax == zMin) ? 1.0f : zMax - zMin);
+        surfacePlotShader.setFloatUniform("zMin", zMin);
+    }
+    else {
+        glDisableVertexAttribArray(1);
+    }
+
+    // segments and quads touching invalid samples are left out, the indices change with the set of invalid samples
+    if (newFrame && (frame.dirtyFlags & DIRTY_INDICES)) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->surfacePlotEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, frame.numIndices*sizeof(uint), frame.indices, GL_STATIC_DRAW);
+    }
+
+    // the strips follow the segments in the same index buffer, frames switching topology are drawn with what they have
+    bool hasLines = frame.topology != TOPOLOGY_TRIANGLES;
+    bool hasStrips = frame.topology != TOPOLOGY_LINES;
+    bool filled = hasStrips && (this->surfaceStyle != STYLE_WIREFRAME || !hasLines);
+    bool lines = hasLines && (!filled || this->surfaceStyle == STYLE_FILLED_WIREFRAME);
+
+    // the surface shaders clip non-finite samples the indices still reference, the other programs write no clip distance
+    glEnable(GL_CLIP_DISTANCE0);
+    if (filled) {
+        bool grid = this->surfaceStyle == STYLE_FILLED_GRID;
+        surfacePlotShader.setIntUniform("shading", grid ? SHADING_GRID : SHADING_LIT);
+        surfacePlotShader.setFloatUniform("gridLineWidth", this->gridLineWidth);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glDrawElements(GL_TRIANGLE_STRIP, frame.numIndices - frame.numLineIndices, GL_UNSIGNED_INT,
+                       (void*)(frame.numLineIndices * sizeof(uint)));
+        glDisable(GL_POLYGON_OFFSET_FILL);
+    }
+    if (lines) {
+        surfacePlotShader.setIntUniform("shading", filled ? SHADING_OVERLAY : SHADING_NONE);
+        glDrawElements(GL_LINES, frame.numLineIndices, GL_UNSIGNED_INT, 0);
+    }
+    glDisable(GL_CLIP_DISTANCE0);
     glBindVertexArray(0);
+
+    // both regions read by this draw
+    if (this->streaming) {
+        fenceStreamRegion(this->streamRegion);
+        if (previousWeight > 0.0f)
+            fenceStreamRegion(this->previousFrame.region);
+    }
 }
 
-void GLProgram::drawCube(void) {
+void GLProgram::fenceStreamRegion(uint region) {
+    GLsync& fence = this->streamFences[region];
+    if (fence)
+        glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+float GLProgram::getPreviousWeight(void) {
+    const StreamedFrame& previous = this->previousFrame;
+    const StreamedFrame& latest = this->latestFrame;
+    if (!this->interpolate || !this->streaming || !previous.valid || !latest.valid || previous.format != latest.format)
+        return 0.0f;
+
+    // falls from 1 to 0 over the time between the two frames, by then the next frame is usually there;
+    // the frame drawn now is shown about one display frame later, so a producer that keeps up with
+    // the display adds no latency
+    float interval = latest.time - previous.time;
+    if (interval <= 0.0f)
+        return 0.0f;
+    float elapsed = glfwGetTime() - this->arrivalTime + this->deltaTime;
+    return std::max(0.0f, 1.0f - elapsed / interval);
+}
+
+void GLProgram::setPreviousHeightAttribute(VertexFormat format, size_t offset) {
+
+    // expects the surface plot VAO and the stream buffer to be bound, z is the third float of full vertices
+    if (format == VERTEX_FORMAT_FULL)
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(offset + 2 * sizeof(float)));
+    else if (format == VERTEX_FORMAT_HEIGHT)
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+    else
+        glVertexAttribPointer(1, 1, GL_HALF_FLOAT, GL_FALSE, 0, (void*)offset);
+}
+
+void GLProgram::drawCube(const SurfaceFrame& frame) {
     this->whiteShader.use();
     glBindVertexArray(this->cubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, this->cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, 24*sizeof(float), this->surfacePlotter.getCubeVertices(), GL_STATIC_DRAW);
+    if (frame.id != this->drawnFrame && (frame.dirtyFlags & DIRTY_CUBE)) {
+        glBindBuffer(GL_ARRAY_BUFFER, this->cubeVBO);
+        glBufferData(GL_ARRAY_BUFFER, 24*sizeof(float), frame.cubeVertices, GL_DYNAMIC_DRAW);
+    }
+    this->drawnFrame = frame.id;
+
     glDrawElements(GL_LINES, 24, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
 }
 
 void GLProgram::cleanup(void) {
 
+    // the producer thread stops before anything it uses goes away, captured frames are finished while the context exists
+    this->surfaceProducer.stop();
+    this->frameCapture.stop();
+
     // clean up gl resources
+    deleteStreamBuffer();
     glDeleteVertexArrays(1, &(this->surfacePlotVAO));
     glDeleteBuffers(1, &(this->surfacePlotVBO));
     glDeleteBuffers(1, &this->surfacePlotEBO);
@@ -171,14 +778,128 @@ void GLProgram::cleanup(void) {
     glDeleteBuffers(1, &(this->cubeVBO));
     glDeleteBuffers(1, &this->cubeEBO);
 
-    // clean up glfw
-    glfwTerminate();
+    glDeleteBuffers(1, &this->cameraUBO);
+    this->computeEvaluator.destroy();
+
+    // clean up the context
+    if (this->headless)
+        this->headlessContext.destroy();
+    else
+        glfwTerminate();
 }
 
 void GLProgram::setClearColor(float r, float g, float b, float alpha) {
     this->clearColor = {r, g, b, alpha};
 }
 
+bool GLProgram::setFunction(const std::string& source, std::string* error) {
+    return this->surfacePlotter.setFunction(source, error);
+}
+
+void GLProgram::setNumThreads(uint numThreads) {
+    this->surfacePlotter.setNumThreads(numThreads);
+}
+
+void GLProgram::setExact(bool exact) {
+    this->surfacePlotter.setExact(exact);
+}
+
+void GLProgram::setPeriod(float period) {
+    this->surfacePlotter.setPeriod(period);
+}
+
+void GLProgram::setCacheBudget(size_t bytes) {
+    this->surfacePlotter.setCacheBudget(bytes);
+}
+
+void GLProgram::setVertexFormat(VertexFormat format) {
+    this->vertexFormat = format;
+    if (this->surfaceProducer.isRunning())
+        this->surfaceProducer.setVertexFormat(format);
+    else
+        this->surfacePlotter.setVertexFormat(format);
+    this->unsettledFrames = WARMUP_FRAMES;
+}
+
+void GLProgram::setSurfaceStyle(SurfaceStyle style) {
+    this->surfaceStyle = style;
+
+    // only the primitives the style draws are built, lit styles take the normals of the CPU evaluation
+    // and light compute shader frames by their facets
+    Topology topology = getStyleTopology(style);
+    bool normals = style != STYLE_WIREFRAME && !this->computeEvaluator.isReady();
+    if (this->surfaceProducer.isRunning()) {
+        this->surfaceProducer.setTopology(topology);
+        this->surfaceProducer.setNormals(normals);
+    }
+    else {
+        this->surfacePlotter.setTopology(topology);
+        this->surfacePlotter.setNormals(normals);
+    }
+    this->unsettledFrames = WARMUP_FRAMES;
+}
+
+void GLProgram::setGridLineWidth(float width) {
+    this->gridLineWidth = std::max(width, GRID_LINE_WIDTH_STEP);
+}
+
+void GLProgram::setStreaming(bool streaming) {
+    this->streaming = streaming;
+
+    // the fallback uploads from the surface plotter's own storage and keeps no previous frame
+    if (!streaming)
+        deleteStreamBuffer();
+    this->previousFrame.valid = false;
+    this->latestFrame.valid = false;
+    this->surfacePlotUploaded = false;
+    this->unsettledFrames = WARMUP_FRAMES;
+}
+
+void GLProgram::setAsync(bool async) {
+    this->async = async;
+}
+
+void GLProgram::setTiming(bool timing) {
+    this->timing = timing;
+}
+
+void GLProgram::setInterpolate(bool interpolate) {
+    this->interpolate = interpolate;
+}
+
+void GLProgram::setOnDemand(bool onDemand) {
+    this->onDemand = onDemand;
+}
+
+bool GLProgram::isIdle(void) {
+
+    // a surface that moves with time, a capture in progress or a held camera key all need the next frame
+    if (!this->onDemand || this->surfacePlotter.dependsOnTime() || this->frameCapture.isActive())
+        return false;
+    for (int key : {GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D})
+        if (glfwGetKey(this->window, key) == GLFW_PRESS)
+            return false;
+
+    // the producer thread posts an empty event when it publishes a frame, e.g. in a new vertex format
+    return true;
+}
+
+void GLProgram::setHeadless(bool headless) {
+    this->headless = headless;
+}
+
+bool GLProgram::setCapture(const std::string& pattern) {
+    return this->frameCapture.start(pattern, CAPTURE_FRAME_RATE);
+}
+
+void GLProgram::setCompute(bool compute) {
+    this->compute = compute;
+}
+
+void GLProgram::setComputeCheck(bool computeCheck) {
+    this->computeCheck = computeCheck;
+}
+
 uint GLProgram::generateBuffer(void) {
     uint buf;
     glGenBuffers(1, &buf);
@@ -258,6 +979,63 @@ void GLProgram::cursorPosCallback(GLFWwindow* window, double xpos, double ypos)
     }
 }
 
+void GLProgram::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+
+    // 'V' cycles through the vertex formats: full -> height -> half height
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+        GLProgram* program = static_cast<GLProgram*>(glfwGetWindowUserPointer(window));
+        program->setVertexFormat((VertexFormat)((program->vertexFormat + 1) % (VERTEX_FORMAT_HALF_HEIGHT + 1)));
+    }
+
+    // 'F' cycles through the surface styles: wireframe -> filled -> filled with wireframe -> filled with grid lines
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        GLProgram* program = static_cast<GLProgram*>(glfwGetWindowUserPointer(window));
+        program->setSurfaceStyle((SurfaceStyle)((program->surfaceStyle + 1) % (STYLE_FILLED_GRID + 1)));
+    }
+
+    // '[' and ']' narrow and widen the grid lines drawn by the fragment shader
+    if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action != GLFW_RELEASE) {
+        GLProgram* program = static_cast<GLProgram*>(glfwGetWindowUserPointer(window));
+        float step = (key == GLFW_KEY_LEFT_BRACKET) ? -GRID_LINE_WIDTH_STEP : GRID_LINE_WIDTH_STEP;
+        program->setGridLineWidth(program->gridLineWidth + step);
+        std::cout << "grid line width: " << program->gridLineWidth << " px" << std::endl;
+    }
+
+    // 'B' switches between the persistent mapped stream and glBufferData, for A/B comparison
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        GLProgram* program = static_cast<GLProgram*>(glfwGetWindowUserPointer(window));
+        program->setStreaming(!program->streaming && GLAD_GL_VERSION_4_4);
+        std::cout << "vertex streaming: " << (program->streaming ? "persistent mapped" : "glBufferData") << std::endl;
+    }
+
+    // 'C' pauses and resumes recording, starting CAPTURE_DEFAULT_PATH if nothing was recorded yet
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        GLProgram* program = static_cast<GLProgram*>(glfwGetWindowUserPointer(window));
+        FrameCapture& capture = program->frameCapture;
+        if (capture.isRecording())
+            capture.setRecording(false);
+        else {
+            capture.setRecording(true);
+            if (!capture.isRecording())
+                capture.start(CAPTURE_DEFAULT_PATH, CAPTURE_FRAME_RATE);
+        }
+        std::cout << "capture: " << (capture.isRecording() ? "recording" : "paused") << std::endl;
+    }
+
+    // 'I' switches temporal interpolation between producer frames on and off
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        GLProgram* program = static_cast<GLProgram*>(glfwGetWindowUserPointer(window));
+        program->setInterpolate(!program->interpolate);
+        std::cout << "interpolation: " << (program->interpolate ? "on" : "off") << std::endl;
+    }
+
+    // 'P' saves the next frame as a screenshot
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        GLProgram* program = static_cast<GLProgram*>(glfwGetWindowUserPointer(window));
+        program->frameCapture.requestScreenshot();
+    }
+}
+
 glm::vec3 GLProgram::getArcballVector(float x, float y) {
 
     // get normalized vector from center of the virtual arcball to a point P on the arcball's surface
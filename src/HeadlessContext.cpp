@@ -0,0 +1,135 @@
+#include "../include/HeadlessContext.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <iostream>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+HeadlessContext::HeadlessContext() :
+    display(NULL), context(NULL), framebuffer(0), colorBuffer(0), depthBuffer(0), resolveFramebuffer(0), resolveColorBuffer(0),
+    width(0), height(0) {}
+
+bool HeadlessContext::create(void) {
+
+    // surfaceless platform first, it needs neither a display server nor a GPU device
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        std::cout << "ERROR: FAILED TO INITIALIZE EGL" << std::endl;
+        return false;
+    }
+    this->display = display;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cout << "ERROR: EGL HAS NO DESKTOP OPENGL" << std::endl;
+        return false;
+    }
+
+    // no surface is ever created, so any config will do
+    EGLConfig config = NULL;
+    EGLint numConfigs = 0;
+    const EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    eglChooseConfig(display, configAttributes, &config, 1, &numConfigs);
+
+    // newest core profile first, llvmpipe stops at 4.5
+    const EGLint versions[][2] = {{4, 6}, {4, 5}};
+    for (const EGLint* version : versions) {
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, version[0],
+            EGL_CONTEXT_MINOR_VERSION, version[1],
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        EGLContext context = eglCreateContext(display, numConfigs ? config : (EGLConfig) NULL, EGL_NO_CONTEXT, contextAttributes);
+        if (context != EGL_NO_CONTEXT) {
+            this->context = context;
+            break;
+        }
+    }
+
+    if (!this->context || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, (EGLContext) this->context)) {
+        std::cout << "ERROR: FAILED TO CREATE SURFACELESS OPENGL 4.5 CONTEXT" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HeadlessContext::createFramebuffer(int width, int height) {
+    this->width = width;
+    this->height = height;
+
+    // multisampled target
+    glGenRenderbuffers(1, &this->colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, this->colorBuffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, HEADLESS_SAMPLES, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &this->depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, HEADLESS_SAMPLES, GL_DEPTH24_STENCIL8, width, height);
+
+    glGenFramebuffers(1, &this->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // single sampled copy for readback
+    glGenRenderbuffers(1, &this->resolveColorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, this->resolveColorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenFramebuffers(1, &this->resolveFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->resolveFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->resolveColorBuffer);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // everything is drawn into the multisampled framebuffer
+    glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+
+    if (!complete)
+        std::cout << "ERROR: OFFSCREEN FRAMEBUFFER IS INCOMPLETE" << std::endl;
+    return complete;
+}
+
+void HeadlessContext::destroy(void) {
+    if (this->framebuffer) {
+        glDeleteFramebuffers(1, &this->framebuffer);
+        glDeleteFramebuffers(1, &this->resolveFramebuffer);
+        glDeleteRenderbuffers(1, &this->colorBuffer);
+        glDeleteRenderbuffers(1, &this->depthBuffer);
+        glDeleteRenderbuffers(1, &this->resolveColorBuffer);
+        this->framebuffer = 0;
+    }
+
+    if (this->display) {
+        eglMakeCurrent((EGLDisplay) this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (this->context)
+            eglDestroyContext((EGLDisplay) this->display, (EGLContext) this->context);
+        eglTerminate((EGLDisplay) this->display);
+        this->display = NULL;
+        this->context = NULL;
+    }
+}
+
+void* HeadlessContext::getProcAddress(const char* name) {
+    return (void*) eglGetProcAddress(name);
+}
+
+void HeadlessContext::resolve(void) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->resolveFramebuffer);
+    glBlitFramebuffer(0, 0, this->width, this->height, 0, 0, this->width, this->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    // the next frame is drawn into the multisampled framebuffer again
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->resolveFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->framebuffer);
+}
@@ -0,0 +1,126 @@
+#include "../include/ImageWriter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <zlib.h>
+
+bool hasExtension(const std::string& path, const char* extension) {
+    size_t length = std::string(extension).size();
+    if (path.size() < length)
+        return false;
+
+    for (size_t i = 0; i < length; ++i)
+        if (tolower(path[path.size() - length + i]) != extension[i])
+            return false;
+    return true;
+}
+
+// PNG
+
+static void appendUint32(std::vector<unsigned char>& data, uint32_t value) {
+    data.push_back(value >> 24);
+    data.push_back(value >> 16);
+    data.push_back(value >> 8);
+    data.push_back(value);
+}
+
+static void appendChunk(std::vector<unsigned char>& png, const char* type, const unsigned char* data, size_t size) {
+    appendUint32(png, size);
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data, data + size);
+
+    // the checksum covers type and data
+    appendUint32(png, crc32(0, png.data() + start, size + 4));
+}
+
+static bool encodePNG(std::vector<unsigned char>& png, const unsigned char* pixels, int width, int height) {
+    size_t rowSize = 3 * (size_t) width;
+
+    // each row starts with its filter type, none
+    std::vector<unsigned char> raw((rowSize + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        unsigned char* row = raw.data() + (rowSize + 1) * y;
+        row[0] = 0;
+        std::copy(pixels + rowSize * (height - 1 - y), pixels + rowSize * (height - y), row + 1);
+    }
+
+    uLongf compressedSize = compressBound(raw.size());
+    std::vector<unsigned char> compressed(compressedSize);
+    if (compress2(compressed.data(), &compressedSize, raw.data(), raw.size(), PNG_COMPRESSION) != Z_OK)
+        return false;
+
+    const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    png.assign(signature, signature + sizeof(signature));
+
+    // 8-bit truecolor, no interlacing
+    std::vector<unsigned char> header;
+    appendUint32(header, width);
+    appendUint32(header, height);
+    header.push_back(8);
+    header.push_back(2);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+
+    appendChunk(png, "IHDR", header.data(), header.size());
+    appendChunk(png, "IDAT", compressed.data(), compressedSize);
+    appendChunk(png, "IEND", NULL, 0);
+    return true;
+}
+
+// IMAGE
+
+bool writeImage(const std::string& path, const unsigned char* pixels, int width, int height) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool written;
+    if (hasExtension(path, ".ppm")) {
+        size_t rowSize = 3 * (size_t) width;
+        written = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+        for (int y = height - 1; written && y >= 0; --y)
+            written = fwrite(pixels + rowSize * y, 1, rowSize, file) == rowSize;
+    } else {
+        std::vector<unsigned char> png;
+        written = encodePNG(png, pixels, width, height) && fwrite(png.data(), 1, png.size(), file) == png.size();
+    }
+
+    written = fclose(file) == 0 && written;
+    if (!written)
+        remove(path.c_str());
+    return written;
+}
+
+bool formatFramePath(const std::string& pattern, int index, std::string& path) {
+    size_t field = std::string::npos;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%')
+            continue;
+        if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+            ++i;
+            continue;
+        }
+
+        // only %d with an optional zero padded width
+        size_t end = i + 1;
+        while (end < pattern.size() && isdigit(pattern[end]))
+            ++end;
+        if (field != std::string::npos || end >= pattern.size() || pattern[end] != 'd')
+            return false;
+        field = i;
+        i = end;
+    }
+    if (field == std::string::npos)
+        return false;
+
+    // reuses the capacity of path, so numbering frames does not allocate
+    int size = snprintf(NULL, 0, pattern.c_str(), index);
+    path.resize(size);
+    snprintf(&path[0], size + 1, pattern.c_str(), index);
+    return true;
+}
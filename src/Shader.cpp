@@ -1,42 +1,124 @@
 #include "../include/Shader.h"
 
-Shader::Shader() {}
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath) {
+// header of a program binary cache entry, followed by length bytes of binary
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t checksum; // of the binary, detects truncated or corrupt entries
+    uint32_t format;
+    uint32_t length;
+};
+
+// FNV-1a, 64 bit
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// creates every missing directory along path
+static bool makeDirectories(const std::string& path) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        std::string directory = path.substr(0, slash);
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+        if (slash == std::string::npos)
+            return true;
+    }
+}
+
+Shader::Shader() :
+    ID(0), uniforms() {}
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath) :
+    uniforms() {
 
     // retrieve vertex / fragment shader source code from file path
-    std::string vertexString, fragmentString;
-    std::ifstream vertexFile, fragmentFile;
-    std::stringstream vertexStream, fragmentStream;
+    std::string vertexString = readShaderFile(vertexPath);
+    std::string fragmentString = readShaderFile(fragmentPath);
 
-    // allow ifstreams to throw exceptions
-    vertexFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fragmentFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    // reuse the program linked by an earlier run with the same sources and driver
+    uint64_t key = 0;
+    std::string cachePath = getProgramCachePath(vertexString, fragmentString, key);
+    if (cachePath.empty() || !loadProgramBinary(cachePath, key)) {
+        compile(vertexString.c_str(), fragmentString.c_str(), !cachePath.empty());
+        if (!cachePath.empty())
+            saveProgramBinary(cachePath, key);
+    }
 
-    try {
-        // open files
-        vertexFile.open(vertexPath);
-        fragmentFile.open(fragmentPath);
+    cacheUniformLocations();
+}
+
+Shader::Shader(const char* computePath, const std::string& appendedCode) :
+    uniforms() {
+    std::string computeString = readShaderFile(computePath) + appendedCode;
 
-        // read file contents into streams
-        vertexStream << vertexFile.rdbuf();
-        fragmentStream << fragmentFile.rdbuf();
+    // cached like the other programs, keyed by the generated code as well
+    uint64_t key = 0;
+    std::string cachePath = getProgramCachePath(computeString, "", key);
+    if (cachePath.empty() || !loadProgramBinary(cachePath, key)) {
+        compileCompute(computeString.c_str(), !cachePath.empty());
+        if (!cachePath.empty())
+            saveProgramBinary(cachePath, key);
+    }
+
+    cacheUniformLocations();
+}
 
-        // close files
-        vertexFile.close();
-        fragmentFile.close();
+std::string Shader::readShaderFile(const char* path) {
+    std::ifstream file;
+    std::stringstream stream;
 
-        // extract strings from streams
-        vertexString = vertexStream.str();
-        fragmentString = fragmentStream.str();
+    // allow ifstreams to throw exceptions
+    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+
+    try {
+        file.open(path);
+        stream << file.rdbuf();
+        file.close();
     }
     catch (std::ifstream::failure e) {
         std::cout << "ERROR: SHADER FILE WAS UNSUCCESSFULLY READ" << std::endl;
         exit(-1);
     }
+    return stream.str();
+}
+
+void Shader::compileCompute(const char* computeCode, bool retrievable) {
+    int success;
+    char infoLog[512];
+
+    uint compute = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(compute, 1, &computeCode, NULL);
+    glCompileShader(compute);
+    checkCompileErrors(compute, "COMPUTE");
+
+    ID = glCreateProgram();
+    if (retrievable)
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glAttachShader(ID, compute);
+    glLinkProgram(ID);
+
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(ID, 512, NULL, infoLog);
+        std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n" << infoLog << std::endl;
+    }
+
+    glDeleteShader(compute);
+}
 
-    const char* vertexCode = vertexString.c_str();
-    const char* fragmentCode = fragmentString.c_str();
+void Shader::compile(const char* vertexCode, const char* fragmentCode, bool retrievable) {
 
     // compile shaders
     uint vertex, fragment;
@@ -57,6 +139,8 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
 
     // shader program
     ID = glCreateProgram();
+    if (retrievable)
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
     glLinkProgram(ID);
@@ -73,20 +157,190 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
     glDeleteShader(fragment);
 }
 
+std::string Shader::getProgramCachePath(const std::string& vertexCode, const std::string& fragmentCode, uint64_t& key) {
+
+    // the driver must be able to hand out program binaries at all
+    int numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats == 0)
+        return "";
+
+    std::string directory;
+    const char* configured = getenv("SURFACE_PLOTTER_SHADER_CACHE");
+    const char* xdgCache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (configured)
+        directory = configured;
+    else if (xdgCache && *xdgCache)
+        directory = std::string(xdgCache) + "/3DSurfacePlotter";
+    else if (home && *home)
+        directory = std::string(home) + "/.cache/3DSurfacePlotter";
+    if (directory.empty() || !makeDirectories(directory))
+        return "";
+
+    // binaries are only valid for the driver that produced them
+    const char* driverStrings[] = {
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION)
+    };
+    key = hashBytes(vertexCode.data(), vertexCode.size() + 1);
+    key = hashBytes(fragmentCode.data(), fragmentCode.size() + 1, key);
+    for (const char* driverString : driverStrings) {
+        if (driverString)
+            key = hashBytes(driverString, strlen(driverString) + 1, key);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+    return directory + name;
+}
+
+bool Shader::loadProgramBinary(const std::string& path, uint64_t key) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    ProgramCacheHeader header;
+    std::vector<char> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_CACHE_MAGIC
+                 && header.version == PROGRAM_CACHE_VERSION && header.key == key;
+    if (valid) {
+        binary.resize(header.length);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size()
+                && hashBytes(binary.data(), binary.size()) == header.checksum;
+    }
+    fclose(file);
+
+    // the driver may still reject a well-formed entry, e.g. after an update that kept its version string
+    int success = 0;
+    if (valid) {
+        ID = glCreateProgram();
+        glProgramBinary(ID, header.format, binary.data(), binary.size());
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    }
+
+    if (!success) {
+        if (valid)
+            glDeleteProgram(ID);
+        ID = 0;
+        remove(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void Shader::saveProgramBinary(const std::string& path, uint64_t key) {
+    int success = 0;
+    int length = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!success || length <= 0)
+        return;
+
+    ProgramCacheHeader header;
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(ID, length, NULL, &format, binary.data());
+
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.checksum = hashBytes(binary.data(), binary.size());
+    header.format = format;
+    header.length = length;
+
+    // written under a unique name and renamed, so concurrent runs never see a partial entry
+    std::string temporary = path + "." + std::to_string(getpid());
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+    written = (fclose(file) == 0) && written;
+
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+        remove(temporary.c_str());
+}
+
+void Shader::cacheUniformLocations(void) {
+    int numUniforms = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &numUniforms);
+
+    for (int i = 0; i < numUniforms; ++i) {
+        char name[256];
+        int size;
+        GLenum type;
+        glGetActiveUniform(ID, i, sizeof(name), NULL, &size, &type, name);
+
+        // members of uniform blocks have no location
+        int location = glGetUniformLocation(ID, name);
+        if (location == -1)
+            continue;
+
+        // arrays are reported as "name[0]", they are set through their base name
+        char* bracket = strchr(name, '[');
+        if (bracket)
+            *bracket = '\0';
+
+        uint32_t hash = hashName(name);
+        uint slot = 0;
+        while (slot < UNIFORM_TABLE_SIZE && !this->uniforms[(hash + slot) & (UNIFORM_TABLE_SIZE - 1)].name.empty())
+            slot++;
+        if (slot == UNIFORM_TABLE_SIZE) {
+            std::cout << "ERROR: TOO MANY UNIFORMS, " << name << " IS NOT CACHED" << std::endl;
+            continue;
+        }
+
+        UniformSlot& entry = this->uniforms[(hash + slot) & (UNIFORM_TABLE_SIZE - 1)];
+        entry.hash = hash;
+        entry.location = location;
+        entry.name = name;
+    }
+}
+
+int Shader::getUniformLocation(const char* name) const {
+    uint32_t hash = hashName(name);
+    for (uint slot = 0; slot < UNIFORM_TABLE_SIZE; ++slot) {
+        const UniformSlot& entry = this->uniforms[(hash + slot) & (UNIFORM_TABLE_SIZE - 1)];
+        if (entry.name.empty())
+            return -1;
+        if (entry.hash == hash && entry.name == name)
+            return entry.location;
+    }
+    return -1;
+}
+
+uint32_t Shader::hashName(const char* name) {
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *name; ++name)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
 void Shader::use(void) {
     glUseProgram(ID);
 }
 
-void Shader::setFloatUniform(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+void Shader::setIntUniform(const char* name, int value) const {
+    glUniform1i(getUniformLocation(name), value);
+}
+
+void Shader::setFloatUniform(const char* name, float value) const {
+    glUniform1f(getUniformLocation(name), value);
+}
+
+void Shader::setVec2Uniform(const char* name, glm::vec2 value) const {
+    glUniform2fv(getUniformLocation(name), 1, glm::value_ptr(value));
 }
 
-void Shader::setVec3Uniform(const std::string &name, glm::vec3 value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+void Shader::setVec3Uniform(const char* name, glm::vec3 value) const {
+    glUniform3fv(getUniformLocation(name), 1, glm::value_ptr(value));
 }
 
-void Shader::setMat4Uniform(const std::string &name, glm::mat4 value) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+void Shader::setMat4Uniform(const char* name, glm::mat4 value) const {
+    glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::checkCompileErrors(uint shader, std::string type) {
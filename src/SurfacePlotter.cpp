@@ -1,16 +1,128 @@
 #include "../include/SurfacePlotter.h"
+#include "../include/VectorMath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 // default constructor
 SurfacePlotter::SurfacePlotter() :
-    xMin(-10.0f), xMax(10.0f), yMin(-10.0f), yMax(10.0f), gridInterval(0.2f), zMin(FLOAT_MAX), zMax(FLOAT_MIN),
-    vertices(NULL), numElements(0), indices(NULL), numIndices(0), cubeVertices(NULL), cubeIndices(NULL) {
-
-    setGrid(this->xMin, this->xMax, this->yMin, this->yMax, this->gridInterval);
-    this->cubeIndices = new uint[24] {
+    numX(0), numY(0), xMin(-10.0f), xMax(10.0f), yMin(-10.0f), yMax(10.0f), gridInterval(0.2f), zMin(FLOAT_MAX), zMax(FLOAT_MIN),
+    numInvalid(0), numEvaluations(0), nativeFunction(NULL), symmetry(SYMMETRY_NONE), exact(false), radialStep(0.0f), radialHasSlopes(false),
+    radialReady(false), separableHasSlopes(false), separableReady(false), timeFactored(false), fieldHasSlopes(false), fieldMin(FLOAT_MAX), fieldMax(FLOAT_MIN), fieldInvalid(0), fieldCurrent(false),
+    frameScale(1.0f), frameOffset(0.0f), factoredReady(false), declaredPeriod(0.0f), period(0.0f), cacheBudget(ANIMATION_CACHE_BUDGET),
+    numKeyframes(0), keyframesFilled(0), keyframeStride(0), keyframeError(0.0f), keyframeMin(FLOAT_MAX), keyframeMax(FLOAT_MIN),
+    cacheFailed(false), keyframeFrom(NULL), keyframeTo(NULL), keyframeWeight(0.0f), cacheReady(false), vertexFormat(VERTEX_FORMAT_FULL), vertexTarget(NULL), normals(false),
+    normalsReady(false), topology(TOPOLOGY_LINES),
+    numLineIndices(0), indicesMasked(false),
+    verticesCurrent(false), externalCurrent(false), verticesTime(0.0f),
+    cubeVertices(), cubeIndices {
         0,1, 1,2, 2,3, 3,0,
         4,5, 5,6, 6,7, 7,4,
         0,4, 1,5, 2,6, 3,7
-    };
+    },
+    dirtyFlags(DIRTY_VERTICES | DIRTY_INDICES | DIRTY_CUBE) {
+
+    setFunction(DEFAULT_FUNCTION);
+    setGrid(this->xMin, this->xMax, this->yMin, this->yMax, this->gridInterval);
+}
+
+bool SurfacePlotter::setFunction(const std::string& source, std::string* error) {
+
+    // parse into a temporary so the current function survives a syntax error
+    Expression parsed;
+    if (!parsed.parse(source)) {
+        if (error)
+            *error = parsed.getError();
+        return false;
+    }
+
+    this->expression = parsed;
+    this->nativeFunction = NULL;
+    this->symmetry = parsed.getSymmetry();
+    bool separable = this->symmetry == SYMMETRY_SEPARABLE_SUM || this->symmetry == SYMMETRY_SEPARABLE_PRODUCT;
+    if (separable && !parsed.separate(this->separableX, this->separableY))
+        this->symmetry = SYMMETRY_NONE;
+    this->timeFactored = parsed.factorTime(this->timeScale, this->timeField, this->timeOffset);
+
+    // slopes for the normals, an expression too complex to differentiate leaves its frames without them
+    parsed.differentiate(this->gradient);
+    if (this->symmetry == SYMMETRY_SEPARABLE_SUM || this->symmetry == SYMMETRY_SEPARABLE_PRODUCT) {
+        this->separableX.differentiate(this->separableXGradient);
+        this->separableY.differentiate(this->separableYGradient);
+    }
+    if (this->timeFactored)
+        this->timeField.differentiate(this->timeFieldGradient);
+    this->fieldCurrent = false;
+    resetAnimationCache();
+    invalidateVertices();
+    return true;
+}
+
+void SurfacePlotter::setFunction(NativeFunction function, Symmetry symmetry) {
+    this->nativeFunction = function;
+    this->symmetry = symmetry;
+    this->timeFactored = false;
+    resetAnimationCache();
+    invalidateVertices();
+}
+
+Symmetry SurfacePlotter::getSymmetry(void) {
+    return this->symmetry;
+}
+
+size_t SurfacePlotter::getNumEvaluations(void) {
+    return this->numEvaluations;
+}
+
+bool SurfacePlotter::isTimeFactored(void) {
+    return this->timeFactored;
+}
+
+void SurfacePlotter::setPeriod(float period) {
+    this->declaredPeriod = period;
+    resetAnimationCache();
+    invalidateVertices();
+}
+
+float SurfacePlotter::getPeriod(void) {
+    return this->period;
+}
+
+void SurfacePlotter::setCacheBudget(size_t bytes) {
+    this->cacheBudget = bytes;
+    resetAnimationCache();
+    invalidateVertices();
+}
+
+bool SurfacePlotter::isCached(void) {
+    return this->cacheReady;
+}
+
+size_t SurfacePlotter::getCacheSize(void) {
+    return (size_t) this->keyframesFilled * this->numX * this->numY * sizeof(float);
+}
+
+void SurfacePlotter::setExact(bool exact) {
+    this->exact = exact;
+    this->fieldCurrent = false;
+    invalidateVertices();
+}
+
+void SurfacePlotter::setNumThreads(uint numThreads) {
+    this->threadPool.setNumThreads(numThreads);
+}
+
+uint SurfacePlotter::getNumThreads(void) {
+    return this->threadPool.getNumThreads();
+}
+
+const Expression& SurfacePlotter::getExpression(void) {
+    return this->expression;
+}
+
+NativeFunction SurfacePlotter::getNativeFunction(void) {
+    return this->nativeFunction;
 }
 
 void SurfacePlotter::setGrid(float xMin, float xMax, float yMin, float yMax, float interval) {
@@ -20,114 +132,749 @@ void SurfacePlotter::setGrid(float xMin, float xMax, float yMin, float yMax, flo
     this->yMax = yMax;
     this->gridInterval = interval;
 
-    // empty grid points array
-    this->gridPoints.clear();
-
-    // fill grid points array
-    for (float x = xMin; x <= xMax; x += interval) {
-        std::vector<glm::vec2> temp;
-        this->gridPoints.push_back(temp);
-        for (float y = yMin; y <= yMax; y += interval) {
-            this->gridPoints[this->gridPoints.size()-1].push_back(glm::vec2(x, y));
-        }
+    // the grid is implicit, point (i, j) is (xMin + i*interval, yMin + j*interval)
+    // counts are rounded so that an endpoint lost to floating-point error is still included
+    this->numX = 0;
+    this->numY = 0;
+    if (interval > 0.0f && xMax >= xMin && yMax >= yMin) {
+        this->numX = (size_t) ((xMax - xMin) / interval + GRID_EPSILON) + 1;
+        this->numY = (size_t) ((yMax - yMin) / interval + GRID_EPSILON) + 1;
     }
+
+    // topology only depends on the grid dimensions until a frame has invalid samples, which may come
+    // long after warm-up, so the masks are sized here, the unmasked indices above already take the most room
+    generateIndices();
+    this->indicesMasked = false;
+    this->validity.reserve(this->numX * this->numY);
+    this->indexValidity.reserve(this->numX * this->numY);
+    this->fieldCurrent = false;
+    resetAnimationCache();
+    invalidateVertices();
 }
 
 void SurfacePlotter::generateSurfacePlot(float time) {
 
+    // vertices already hold this frame, or the same surface of a static function
+    if (this->verticesCurrent && (time == this->verticesTime || !dependsOnTime()))
+        return;
+
     // reset ranges
     this->zMin = FLOAT_MAX;
     this->zMax = FLOAT_MIN;
+    this->numInvalid = 0;
+    this->numEvaluations = 0;
 
     // empty grid
-    if (this->gridPoints.empty())
+    if (this->numX == 0 || this->numY == 0)
         return;
 
     // vertices:
 
-    // deallocate old data
-    if (this->vertices)
-        delete[] this->vertices;
+    // reuses the previous frame's storage unless the grid grew, an external target needs none and
+    // the half height format only the half floats, normals follow the vertices at getNormalOffset, 32 bits each
+    size_t numX = this->numX;
+    size_t numVertices = numX * this->numY;
+    size_t numNormals = hasNormalData() ? numVertices : 0;
+    if (!this->vertexTarget) {
+        if (this->vertexFormat == VERTEX_FORMAT_HALF_HEIGHT) {
+            this->vertices.clear();
+            this->halfVertices.resize((numVertices + 1) / 2 * 2 + 2 * numNormals);
+        }
+        else {
+            this->vertices.resize((this->vertexFormat == VERTEX_FORMAT_FULL ? 3 : 1) * numVertices + numNormals);
+        }
+    }
+    this->validity.resize(numVertices);
+
+    // a cached field, or one line and one column, or keyframes, or one radius, instead of the whole grid
+    Symmetry symmetry = this->exact ? SYMMETRY_NONE : this->symmetry;
+    this->factoredReady = !this->exact && this->timeFactored && prepareTimeField(time);
+    this->separableReady = !this->factoredReady && (symmetry == SYMMETRY_SEPARABLE_SUM || symmetry == SYMMETRY_SEPARABLE_PRODUCT)
+                           && evaluateSeparable(time);
+    this->radialReady = !this->factoredReady && symmetry == SYMMETRY_RADIAL && buildRadialProfile(time);
+    this->cacheReady = !this->factoredReady && !this->separableReady && !this->radialReady && !this->exact && numNormals == 0 &&
+                       prepareAnimationCache(time);
+    if (!this->factoredReady && !this->separableReady && !this->cacheReady && !this->radialReady)
+        this->numEvaluations += numX * this->numY;
 
-    // determine number of rows in x and y axes
-    int numX = this->gridPoints.size();
-    int numY = this->gridPoints[0].size();
+    // each path evaluates its slopes along with its values
+    bool slopes = this->factoredReady ? this->fieldHasSlopes : this->separableReady ? this->separableHasSlopes
+                  : this->radialReady ? this->radialHasSlopes : this->gradient.hasGradient();
+    this->normalsReady = numNormals > 0 && slopes;
 
-    // allocate memory for new data
-    this->numElements = 3 * numX * numY;
-    this->vertices = new float[this->numElements];
+    // generate vertices, the grid rows are split into bands that are evaluated in parallel
+    uint numBands = std::min(numX, (size_t) this->threadPool.getNumThreads() * BANDS_PER_THREAD);
+    this->bands.resize(numBands);
+
+    auto generateBand = [this, numX, numBands, time](uint band) {
+        generateRows(numX * band / numBands, numX * (band + 1) / numBands, time, this->bands[band]);
+    };
+    this->threadPool.parallelFor(numBands, generateBand);
 
-    // generate vertices
-    for (int x = 0; x < numX; ++x) {
-        for (int y = 0; y < numY; ++y) {
+    // merge band z ranges
+    for (const Band& range : this->bands) {
+        if (range.zMin < this->zMin)
+            this->zMin = range.zMin;
+        if (range.zMax > this->zMax)
+            this->zMax = range.zMax;
+        this->numInvalid += range.numInvalid;
+        this->numEvaluations += range.numEvaluations;
+    }
 
-            // add vertex
-            this->vertices[(x * numY + y) * 3 + 0] = this->gridPoints[x][y].x; // x
-            this->vertices[(x * numY + y) * 3 + 1] = this->gridPoints[x][y].y; // y
-            this->vertices[(x * numY + y) * 3 + 2] = f(this->gridPoints[x][y].x, this->gridPoints[x][y].y, time); // z time-dependent
+    // the range of a * g + b follows from the range of g, the sign of a decides which end is which
+    if (this->factoredReady) {
+        this->numInvalid = this->fieldInvalid;
+        if (this->fieldInvalid < numX * this->numY) {
+            float low = this->frameScale * this->fieldMin + this->frameOffset;
+            float high = this->frameScale * this->fieldMax + this->frameOffset;
+            this->zMin = std::min(low, high);
+            this->zMax = std::max(low, high);
         }
     }
+    updateIndices(this->factoredReady ? this->fieldValidity.data() : this->validity.data());
+
+    this->verticesCurrent = true;
+    this->externalCurrent = false;
+    this->verticesTime = time;
+    this->dirtyFlags |= DIRTY_VERTICES;
+
+    generateCube();
+}
+
+void SurfacePlotter::setExternalSurface(float time) {
+    this->normalsReady = false;
+    this->verticesCurrent = false;
+    this->externalCurrent = true;
+    this->verticesTime = time;
+    this->dirtyFlags |= DIRTY_VERTICES;
+}
+
+void SurfacePlotter::setExternalRange(float zMin, float zMax, size_t numInvalid, const uint8_t* valid) {
+    this->zMin = zMin;
+    this->zMax = zMax;
+    this->numInvalid = numInvalid;
+    updateIndices(valid);
+
+    generateCube();
+}
 
-    // indices:
+bool SurfacePlotter::dependsOnTime(void) {
+    return this->nativeFunction || this->expression.dependsOnTime();
+}
+
+bool SurfacePlotter::isCurrent(float time) {
+    return (this->verticesCurrent || this->externalCurrent) && (time == this->verticesTime || !dependsOnTime());
+}
+
+void SurfacePlotter::invalidateVertices(void) {
+    this->verticesCurrent = false;
+    this->externalCurrent = false;
+}
+
+void SurfacePlotter::generateIndices(const uint8_t* valid) {
+
+    this->indices.clear();
+    this->numLineIndices = 0;
+    this->dirtyFlags |= DIRTY_INDICES;
+
+    // empty grid
+    if (this->numX == 0 || this->numY == 0)
+        return;
 
-    // deallocte old data
-    if (this->indices)
-        delete[] this->indices;
+    size_t numX = this->numX;
+    size_t numY = this->numY;
 
-    // determine number of indices
-    this->numIndices = (numX * (numY-1) + numY * (numX - 1)) * 2;
+    // determine number of indices, an upper bound when segments are masked, strips take
+    // two indices per grid point and a restart per pair of grid lines
+    bool lines = this->topology != TOPOLOGY_TRIANGLES;
+    bool strips = this->topology != TOPOLOGY_LINES;
+    size_t numLines = lines ? (numX * (numY-1) + numY * (numX - 1)) * 2 : 0;
+    size_t numStrips = strips ? (numX - 1) * (2*numY + 1) : 0;
+    this->indices.resize(numLines + numStrips);
 
-    // allocate memory for new data
-    this->indices = new uint[this->numIndices];
+    size_t i = 0;
 
-    int i = 0;
+    // a segment is drawn when both its ends are finite
+    if (lines) {
+        for (size_t x = 0; x < numX; ++x) {
+            for (size_t y = 0; y < numY-1; ++y) {
+                if (valid && !(valid[x*numY + y] & valid[x*numY + y+1]))
+                    continue;
+                this->indices[i++] = x*numY + y;
+                this->indices[i++] = x*numY + y+1;
+            }
+        }
 
-    for (int x = 0; x < numX; ++x) {
-        for (int y = 0; y < numY-1; ++y) {
-            this->indices[i++] = x*numY + y;
-            this->indices[i++] = x*numY + y+1;
+        for (size_t y = 0; y < numY; ++y) {
+            for (size_t x = 0; x < numX-1; ++x) {
+                if (valid && !(valid[x*numY + y] & valid[(x+1)*numY + y]))
+                    continue;
+                this->indices[i++] = x*numY + y;
+                this->indices[i++] = (x+1)*numY + y;
+            }
         }
     }
 
-    for (int y = 0; y < numY; ++y) {
-        for (int x = 0; x < numX-1; ++x) {
-            this->indices[i++] = x*numY + y;
-            this->indices[i++] = (x+1)*numY + y;
+    this->numLineIndices = i;
+    if (strips)
+        i += generateStrips(valid, this->indices.data() + i);
+
+    this->indices.resize(i);
+}
+
+size_t SurfacePlotter::generateStrips(const uint8_t* valid, uint* strips) {
+    size_t numX = this->numX;
+    size_t numY = this->numY;
+    size_t i = 0;
+
+    // one strip zigzags between grid lines x and x+1, a quad is drawn when its four corners are finite,
+    // so the strip is restarted at every grid column with an invalid sample on either line
+    for (size_t x = 0; x + 1 < numX; ++x) {
+        size_t run = 0;
+        for (size_t y = 0; y < numY; ++y) {
+            if (valid && !(valid[x*numY + y] & valid[(x+1)*numY + y])) {
+
+                // a single column has no quad, its two indices are taken back
+                if (run == 1)
+                    i -= 2;
+                else if (run > 1)
+                    strips[i++] = PRIMITIVE_RESTART_INDEX;
+                run = 0;
+                continue;
+            }
+            strips[i++] = x*numY + y;
+            strips[i++] = (x+1)*numY + y;
+            run++;
         }
+
+        if (run == 1)
+            i -= 2;
+        else if (run > 1)
+            strips[i++] = PRIMITIVE_RESTART_INDEX;
     }
 
-    generateCube();
+    // no restart needed after the last strip
+    if (i > 0)
+        i--;
+    return i;
 }
 
-float SurfacePlotter::f(float x, float y, float t) {
+void SurfacePlotter::updateIndices(const uint8_t* valid) {
 
-    // EQUATION
-    float z = sin(t) * 8*sin(sqrt(pow(x, 2) + pow(y, 2))) / sqrt(pow(x, 2) + pow(y, 2)); // sombrero equation
-    //float z = sin(pow(x/2.5, 2) + pow(y/2.5, 2));
-    //float z = (pow(x/1.5,2) + pow(y/1.5,2)) * 0.3; // parabaloid
+    // the indices only change with the set of invalid samples, usually never
+    if (this->numInvalid == 0) {
+        if (this->indicesMasked) {
+            generateIndices();
+            this->indicesMasked = false;
+        }
+        return;
+    }
 
-    // update z ranges
-    if (z < this->zMin)
-        this->zMin = z;
-    if (z > this->zMax)
-        this->zMax = z;
+    size_t numVertices = this->numX * this->numY;
+    if (this->indicesMasked && memcmp(this->indexValidity.data(), valid, numVertices) == 0)
+        return;
 
-    return z;
+    generateIndices(valid);
+    this->indexValidity.resize(numVertices);
+    memcpy(this->indexValidity.data(), valid, numVertices);
+    this->indicesMasked = true;
+}
+
+void SurfacePlotter::generateRows(size_t xBegin, size_t xEnd, float time, Band& range) {
+    size_t numY = this->numY;
+
+    // z range is accumulated locally, bands sharing a cache line are written once at the end
+    float zMin = FLOAT_MAX;
+    float zMax = FLOAT_MIN;
+    size_t numInvalid = 0;
+    size_t numEvaluations = 0;
+
+    // y coordinates are the same for every grid line
+    AlignedBuffer<float>& ys = range.ys;
+    AlignedBuffer<float>& zs = range.zs;
+    ys.resize(numY);
+    zs.resize(numY);
+    for (size_t y = 0; y < numY; ++y)
+        ys[y] = getGridY(y);
+
+    float* floatVertices = this->vertexTarget ? static_cast<float*>(this->vertexTarget) : this->vertices.data();
+    uint16_t* halfVertices = this->vertexTarget ? static_cast<uint16_t*>(this->vertexTarget) : this->halfVertices.data();
+
+    // slopes of each grid line, encoded into its normals once the line is done
+    bool normals = this->normalsReady;
+    uint32_t* normalTarget = normals ? getNormalTarget() : NULL;
+    AlignedBuffer<float>& dzdx = range.dzdx;
+    AlignedBuffer<float>& dzdy = range.dzdy;
+    if (normals) {
+        dzdx.resize(numY);
+        dzdy.resize(numY);
+    }
+
+    // the height format stores z only, so it is evaluated in place unless the target is
+    // mapped GPU memory, which is slow to read back for the z range
+    bool inPlace = this->vertexFormat == VERTEX_FORMAT_HEIGHT && !this->vertexTarget;
+
+    for (size_t x = xBegin; x < xEnd; ++x) {
+        float gridX = getGridX(x);
+        float* z = inPlace ? floatVertices + x * numY : zs.data();
+        const float* slopesX = dzdx.data();
+        const float* slopesY = dzdy.data();
+        float slopeScale = 1.0f;
+
+        if (this->factoredReady) {
+            scaleOffset(z, this->frameScale, this->fieldValues.data() + x * numY, this->frameOffset, numY);
+            if (normals) {
+                slopesX = this->fieldSlopesX.data() + x * numY;
+                slopesY = this->fieldSlopesY.data() + x * numY;
+                slopeScale = this->frameScale;
+            }
+        }
+        else if (this->separableReady) {
+
+            // the band's rows share h, which stays in cache from one row to the next, and so do the slopes:
+            // (g', h') for sums and (g' * h, g * h') for products
+            if (this->symmetry == SYMMETRY_SEPARABLE_SUM) {
+                broadcastAdd(z, this->separableXs[x], this->separableYs.data(), numY);
+                if (normals) {
+                    std::fill(dzdx.data(), dzdx.data() + numY, this->separableXSlopes[x]);
+                    slopesY = this->separableYSlopes.data();
+                }
+            }
+            else {
+                broadcastMul(z, this->separableXs[x], this->separableYs.data(), numY);
+                if (normals) {
+                    broadcastMul(dzdx.data(), this->separableXSlopes[x], this->separableYs.data(), numY);
+                    broadcastMul(dzdy.data(), this->separableXs[x], this->separableYSlopes.data(), numY);
+                }
+            }
+        }
+        else if (this->cacheReady) {
+            blend(z, this->keyframeFrom + x * numY, this->keyframeTo + x * numY, this->keyframeWeight, numY);
+        }
+        else if (this->radialReady) {
+            numEvaluations += lookupRadialProfile(gridX, ys.data(), time, z, normals ? dzdx.data() : NULL,
+                                                  normals ? dzdy.data() : NULL, numY);
+        }
+        else if (this->nativeFunction) {
+            for (size_t y = 0; y < numY; ++y)
+                z[y] = f(gridX, ys[y], time);
+        }
+        else if (normals) {
+            // z and its slopes from one pass over the differentiated expression
+            this->gradient.evaluateGradientColumn(gridX, ys.data(), time, z, dzdx.data(), dzdy.data(), numY);
+        }
+        else {
+            // parsed expressions are evaluated one grid line at a time by the SIMD interpreter
+            this->expression.evaluateColumn(gridX, ys.data(), time, z, numY);
+        }
+
+        if (this->vertexFormat == VERTEX_FORMAT_FULL) {
+            float* vertex = floatVertices + x * numY * 3;
+            for (size_t y = 0; y < numY; ++y) {
+
+                // add vertex
+                vertex[y * 3 + 0] = gridX; // x
+                vertex[y * 3 + 1] = ys[y]; // y
+                vertex[y * 3 + 2] = z[y];  // z time-dependent
+            }
+        }
+        else if (this->vertexFormat == VERTEX_FORMAT_HALF_HEIGHT) {
+            convertToHalf(z, halfVertices + x * numY, numY);
+        }
+        else if (!inPlace) {
+            memcpy(floatVertices + x * numY, z, numY * sizeof(float));
+        }
+
+        if (normals)
+            encodeNormals(slopesX, slopesY, slopeScale, normalTarget + x * numY, numY);
+
+        // update z ranges, NaN and infinities are counted and masked instead
+        if (!this->factoredReady)
+            numInvalid += accumulateRange(z, this->validity.data() + x * numY, numY, &zMin, &zMax);
+    }
+
+    range.zMin = zMin;
+    range.zMax = zMax;
+    range.numInvalid = numInvalid;
+    range.numEvaluations = numEvaluations;
+}
+
+bool SurfacePlotter::buildRadialProfile(float time) {
+
+    // radius of the farthest grid corner
+    float xs[2] = {getGridX(0), getGridX(this->numX - 1)};
+    float ys[2] = {getGridY(0), getGridY(this->numY - 1)};
+    float rMax = 0.0f;
+    for (float x : xs)
+        for (float y : ys)
+            rMax = std::max(rMax, std::sqrt(x * x + y * y));
+
+    // dz/dr is dz/dx along the profile's radius
+    bool slopes = hasNormalData() && this->gradient.hasGradient();
+
+    float step = this->gridInterval / RADIAL_OVERSAMPLING;
+    for (int refinement = 0; refinement <= RADIAL_REFINEMENTS; ++refinement, step /= 2) {
+
+        // samples every half step, the odd ones measure the error of interpolating whole steps
+        size_t numSamples = 2 * ((size_t) (rMax / step) + 2) + 1;
+        if (numSamples * 2 > this->numX * this->numY)
+            return false;
+
+        this->sampleCoordinates.resize(numSamples);
+        this->radialProfile.resize(numSamples);
+        float* radii = this->sampleCoordinates.data();
+        float* profile = this->radialProfile.data();
+        for (size_t k = 0; k < numSamples; ++k)
+            radii[k] = k * (step / 2);
+
+        if (this->nativeFunction) {
+            for (size_t k = 0; k < numSamples; ++k)
+                profile[k] = f(radii[k], 0.0f, time);
+        }
+        else if (slopes) {
+            this->radialSlopes.resize(numSamples);
+            this->gradient.evaluateGradientRow(radii, 0.0f, time, profile, this->radialSlopes.data(), NULL, numSamples);
+        }
+        else {
+            this->expression.evaluateRow(radii, 0.0f, time, profile, numSamples);
+        }
+
+        // non-finite samples are not interpolated, see lookupRadialProfile
+        float zMin = FLOAT_MAX, zMax = FLOAT_MIN;
+        float error = 0.0f;
+        for (size_t k = 0; k < numSamples; ++k) {
+            if (!std::isfinite(profile[k]))
+                continue;
+            zMin = std::min(zMin, profile[k]);
+            zMax = std::max(zMax, profile[k]);
+            if (k % 2 == 1 && std::isfinite(profile[k - 1]) && std::isfinite(profile[k + 1]))
+                error = std::max(error, std::fabs(profile[k] - 0.5f * (profile[k - 1] + profile[k + 1])));
+        }
+
+        // the grid is interpolated at half steps, which quarters the error of smooth profiles
+        if (error / 4 <= RADIAL_TOLERANCE * std::max(zMax - zMin, 0.0f)) {
+            this->radialStep = step / 2;
+            this->radialHasSlopes = slopes;
+            this->numEvaluations += numSamples;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t SurfacePlotter::lookupRadialProfile(float x, const float* ys, float time, float* z, float* dzdx, float* dzdy, size_t n) {
+    int last = this->radialProfile.size() - 2;
+    interpolateRadial(this->radialProfile.data(), last, this->radialStep, x, ys, z, n);
+
+    // the slope along the radius points away from the origin, the top of a smooth surface is flat
+    if (dzdx) {
+        interpolateRadial(this->radialSlopes.data(), last, this->radialStep, x, ys, dzdx, n);
+        for (size_t y = 0; y < n; ++y) {
+            float r = std::sqrt(x * x + ys[y] * ys[y]);
+            float slope = (r > 0.0f) ? dzdx[y] / r : 0.0f;
+            dzdx[y] = slope * x;
+            dzdy[y] = slope * ys[y];
+        }
+    }
+
+    // next to a singularity the profile says nothing, those points are evaluated exactly
+    size_t numExact = 0;
+    for (size_t y = 0; y < n; ++y) {
+        if (!std::isfinite(z[y])) {
+            if (dzdx)
+                this->gradient.evaluateGradientColumn(x, ys + y, time, z + y, dzdx + y, dzdy + y, 1);
+            else
+                z[y] = f(x, ys[y], time);
+            numExact++;
+        }
+    }
+    return numExact;
+}
+
+bool SurfacePlotter::prepareTimeField(float time) {
+    this->frameScale = this->timeScale.evaluate(0.0f, 0.0f, time);
+    this->frameOffset = this->timeOffset.evaluate(0.0f, 0.0f, time);
+    this->numEvaluations += 2;
+
+    // a non-finite a or b would not keep the field's validity
+    if (!std::isfinite(this->frameScale) || !std::isfinite(this->frameOffset))
+        return false;
+
+    if (!this->fieldCurrent)
+        buildTimeField();
+    return true;
+}
+
+void SurfacePlotter::buildTimeField(void) {
+    size_t numX = this->numX;
+    size_t numY = this->numY;
+    this->fieldValues.resize(numX * numY);
+    this->fieldValidity.resize(numX * numY);
+
+    // the slopes are cached with the field while normals are requested
+    bool slopes = hasNormalData() && this->timeFieldGradient.hasGradient();
+    if (slopes) {
+        this->fieldSlopesX.resize(numX * numY);
+        this->fieldSlopesY.resize(numX * numY);
+    }
+
+    // the same bands as the frames, each keeps the range of its part of the field
+    uint numBands = std::min(numX, (size_t) this->threadPool.getNumThreads() * BANDS_PER_THREAD);
+    this->bands.resize(numBands);
+
+    auto evaluateBand = [this, numX, numY, numBands, slopes](uint band) {
+        Band& range = this->bands[band];
+        range.zMin = FLOAT_MAX;
+        range.zMax = FLOAT_MIN;
+        range.numInvalid = 0;
+        range.ys.resize(numY);
+        for (size_t y = 0; y < numY; ++y)
+            range.ys[y] = getGridY(y);
+
+        for (size_t x = numX * band / numBands; x < numX * (band + 1) / numBands; ++x) {
+            float* field = this->fieldValues.data() + x * numY;
+            if (slopes) {
+                this->timeFieldGradient.evaluateGradientColumn(getGridX(x), range.ys.data(), 0.0f, field, this->fieldSlopesX.data() + x * numY,
+                                                               this->fieldSlopesY.data() + x * numY, numY);
+            }
+            else {
+                this->timeField.evaluateColumn(getGridX(x), range.ys.data(), 0.0f, field, numY);
+            }
+            range.numInvalid += accumulateRange(field, this->fieldValidity.data() + x * numY, numY, &range.zMin, &range.zMax);
+        }
+    };
+    this->threadPool.parallelFor(numBands, evaluateBand);
+
+    this->fieldMin = FLOAT_MAX;
+    this->fieldMax = FLOAT_MIN;
+    this->fieldInvalid = 0;
+    for (const Band& range : this->bands) {
+        this->fieldMin = std::min(this->fieldMin, range.zMin);
+        this->fieldMax = std::max(this->fieldMax, range.zMax);
+        this->fieldInvalid += range.numInvalid;
+    }
+
+    this->fieldCurrent = true;
+    this->fieldHasSlopes = slopes;
+    this->numEvaluations += numX * numY;
+}
+
+// keyframe indices in the order they are filled, every level of the cache completes in turn
+static uint reverseBits(uint n, uint numBits) {
+    uint reversed = 0;
+    for (uint bit = 0; bit < numBits; ++bit)
+        reversed |= ((n >> bit) & 1) << (numBits - 1 - bit);
+    return reversed;
+}
+
+void SurfacePlotter::resetAnimationCache(void) {
+
+    // time factored and separable functions are as cheap to evaluate as a frame is to interpolate
+    bool separable = this->symmetry == SYMMETRY_SEPARABLE_SUM || this->symmetry == SYMMETRY_SEPARABLE_PRODUCT;
+    this->period = 0.0f;
+    if (this->cacheBudget > 0 && dependsOnTime() && !this->timeFactored && !separable) {
+        bool declared = this->declaredPeriod > 0.0f || this->nativeFunction;
+        this->period = declared ? this->declaredPeriod : this->expression.findPeriod();
+    }
+
+    // the keyframes keep their storage for the next function or grid
+    this->keyframes.clear();
+    this->numKeyframes = 0;
+    this->keyframesFilled = 0;
+    this->keyframeStride = 0;
+    this->keyframeError = 0.0f;
+    this->keyframeMin = FLOAT_MAX;
+    this->keyframeMax = FLOAT_MIN;
+    this->cacheFailed = false;
+}
+
+bool SurfacePlotter::prepareAnimationCache(float time) {
+    if (this->period <= 0.0f || this->cacheFailed)
+        return false;
+
+    // as many keyframes as the budget holds, in one allocation made before the first is filled
+    size_t gridSize = this->numX * this->numY;
+    if (this->numKeyframes == 0) {
+        uint numKeyframes = ANIMATION_MAX_KEYFRAMES;
+        while (numKeyframes >= ANIMATION_MIN_KEYFRAMES && numKeyframes * gridSize * sizeof(float) > this->cacheBudget)
+            numKeyframes /= 2;
+        if (numKeyframes < ANIMATION_MIN_KEYFRAMES) {
+            this->cacheFailed = true;
+            return false;
+        }
+        this->numKeyframes = numKeyframes;
+        this->keyframes.resize(numKeyframes * gridSize);
+    }
+
+    // one keyframe per frame until a level is within the tolerance, the frames are evaluated exactly meanwhile
+    if (this->keyframeStride == 0) {
+        fillKeyframe();
+        if (this->keyframeStride == 0)
+            return false;
+    }
+
+    // keyframes of the level played back either side of this frame's phase
+    uint numPlayed = this->numKeyframes / this->keyframeStride;
+    float phase = std::fmod(time, this->period) / this->period;
+    if (phase < 0.0f)
+        phase += 1.0f;
+    float position = phase * numPlayed;
+    uint k = std::min((uint) position, numPlayed - 1);
+    this->keyframeWeight = position - k;
+    this->keyframeFrom = this->keyframes.data() + (size_t) k * this->keyframeStride * gridSize;
+    this->keyframeTo = this->keyframes.data() + (size_t) ((k + 1) % numPlayed) * this->keyframeStride * gridSize;
+    return true;
+}
+
+void SurfacePlotter::fillKeyframe(void) {
+    size_t numX = this->numX;
+    size_t numY = this->numY;
+    size_t gridSize = numX * numY;
+    uint numBits = 0;
+    while ((1u << numBits) < this->numKeyframes)
+        numBits++;
+
+    // from the second keyframe on, each one is the midpoint of two neighbours of the previous level,
+    // the first keyframe of a level starts measuring the previous level's error
+    uint filled = this->keyframesFilled;
+    uint index = reverseBits(filled, numBits);
+    float* keyframe = this->keyframes.data() + index * gridSize;
+    const float* before = NULL;
+    const float* after = NULL;
+    if (filled > 0) {
+        uint level = 0;
+        while ((2u << level) <= filled)
+            level++;
+        uint half = this->numKeyframes >> (level + 1);
+        before = this->keyframes.data() + (index - half) * gridSize;
+        after = this->keyframes.data() + ((index + half) % this->numKeyframes) * gridSize;
+        if ((filled & (filled - 1)) == 0)
+            this->keyframeError = 0.0f;
+    }
+    float time = this->period * index / this->numKeyframes;
+
+    // the same bands as the frames, the validity buffer is scratch until the frame is generated
+    uint numBands = std::min(numX, (size_t) this->threadPool.getNumThreads() * BANDS_PER_THREAD);
+    this->bands.resize(numBands);
+
+    auto evaluateBand = [this, numX, numY, numBands, keyframe, before, after, time](uint band) {
+        Band& range = this->bands[band];
+        range.zMin = FLOAT_MAX;
+        range.zMax = FLOAT_MIN;
+        range.numInvalid = 0;
+        range.keyframeError = 0.0f;
+        range.ys.resize(numY);
+        for (size_t y = 0; y < numY; ++y)
+            range.ys[y] = getGridY(y);
+
+        for (size_t x = numX * band / numBands; x < numX * (band + 1) / numBands; ++x) {
+            float gridX = getGridX(x);
+            float* z = keyframe + x * numY;
+            if (this->nativeFunction) {
+                for (size_t y = 0; y < numY; ++y)
+                    z[y] = f(gridX, range.ys[y], time);
+            }
+            else {
+                this->expression.evaluateColumn(gridX, range.ys.data(), time, z, numY);
+            }
+            range.numInvalid += accumulateRange(z, this->validity.data() + x * numY, numY, &range.zMin, &range.zMax);
+            if (!before)
+                continue;
+
+            // interpolation error at this keyframe, samples whose validity differs are never within the tolerance
+            float error = midpointError(z, before + x * numY, after + x * numY, numY);
+            range.keyframeError = std::max(range.keyframeError, error);
+        }
+    };
+    this->threadPool.parallelFor(numBands, evaluateBand);
+
+    for (const Band& range : this->bands) {
+        this->keyframeMin = std::min(this->keyframeMin, range.zMin);
+        this->keyframeMax = std::max(this->keyframeMax, range.zMax);
+        this->keyframeError = std::max(this->keyframeError, range.keyframeError);
+    }
+    this->numEvaluations += gridSize;
+    this->keyframesFilled = ++filled;
+
+    // a complete level is played back once its error is within the tolerance, linear interpolation
+    // between keyframes half as far apart is about four times as close as the previous level measured
+    if ((filled & (filled - 1)) == 0 && filled >= ANIMATION_MIN_KEYFRAMES) {
+        float zRange = std::max(this->keyframeMax - this->keyframeMin, 0.0f);
+        if (0.25f * this->keyframeError <= ANIMATION_CACHE_TOLERANCE * zRange)
+            this->keyframeStride = this->numKeyframes / filled;
+        else if (filled == this->numKeyframes)
+            this->cacheFailed = true;
+    }
+}
+
+bool SurfacePlotter::evaluateSeparable(float time) {
+    size_t numX = this->numX;
+    size_t numY = this->numY;
+    this->separableXs.resize(numX);
+    this->separableYs.resize(numY);
+    float* gs = this->separableXs.data();
+    float* hs = this->separableYs.data();
+    this->separableHasSlopes = false;
+
+    if (this->nativeFunction) {
+
+        // a declared separable function is split through the origin, f(x, 0) + f(0, y) - f(0, 0)
+        // or f(x, 0) * f(0, y) / f(0, 0)
+        float origin = f(0.0f, 0.0f, time);
+        bool sum = this->symmetry == SYMMETRY_SEPARABLE_SUM;
+        if (!std::isfinite(origin) || (!sum && origin == 0.0f))
+            return false;
+        for (size_t x = 0; x < numX; ++x)
+            gs[x] = f(getGridX(x), 0.0f, time);
+        for (size_t y = 0; y < numY; ++y)
+            hs[y] = sum ? f(0.0f, getGridY(y), time) - origin : f(0.0f, getGridY(y), time) / origin;
+        this->numEvaluations += numX + numY + 1;
+        return true;
+    }
+
+    // x varies along the grid lines' batch, then y along the columns', g' and h' come from the same passes
+    AlignedBuffer<float>& coordinates = this->sampleCoordinates;
+    coordinates.resize(std::max(numX, numY));
+    bool slopes = hasNormalData() && this->separableXGradient.hasGradient() && this->separableYGradient.hasGradient();
+    if (slopes) {
+        this->separableXSlopes.resize(numX);
+        this->separableYSlopes.resize(numY);
+    }
+
+    for (size_t x = 0; x < numX; ++x)
+        coordinates[x] = getGridX(x);
+    if (slopes)
+        this->separableXGradient.evaluateGradientRow(coordinates.data(), 0.0f, time, gs, this->separableXSlopes.data(), NULL, numX);
+    else
+        this->separableX.evaluateRow(coordinates.data(), 0.0f, time, gs, numX);
+
+    for (size_t y = 0; y < numY; ++y)
+        coordinates[y] = getGridY(y);
+    if (slopes)
+        this->separableYGradient.evaluateGradientColumn(0.0f, coordinates.data(), time, hs, NULL, this->separableYSlopes.data(), numY);
+    else
+        this->separableY.evaluateColumn(0.0f, coordinates.data(), time, hs, numY);
+    this->separableHasSlopes = slopes;
+
+    this->numEvaluations += numX + numY;
+    return true;
+}
+
+float SurfacePlotter::f(float x, float y, float t) {
+
+    // EQUATION, safe to call from several threads
+    return this->nativeFunction ? this->nativeFunction(x, y, t) : this->expression.evaluate(x, y, t);
 }
 
 void SurfacePlotter::generateCube(void) {
 
     // empty grid
-    if (this->gridPoints.empty())
+    if (this->numX == 0 || this->numY == 0)
         return;
 
     // vertices:
 
-    // deallocate old data
-    if (this->cubeVertices)
-        delete[] this->cubeVertices;
-
-    this->cubeVertices = new float[24] {
+    float vertices[24] = {
         this->xMax, this->yMin, this->zMin,
         this->xMax, this->yMax, this->zMin,
         this->xMin, this->yMax, this->zMin,
@@ -137,6 +884,29 @@ void SurfacePlotter::generateCube(void) {
         this->xMin, this->yMax, this->zMax,
         this->xMin, this->yMin, this->zMax
     };
+
+    // bounding box unchanged
+    if (memcmp(vertices, this->cubeVertices, sizeof(vertices)) == 0)
+        return;
+
+    memcpy(this->cubeVertices, vertices, sizeof(vertices));
+    this->dirtyFlags |= DIRTY_CUBE;
+}
+
+uint SurfacePlotter::getDirtyFlags(void) {
+    return this->dirtyFlags;
+}
+
+void SurfacePlotter::clearDirtyFlags(uint flags) {
+    this->dirtyFlags &= ~flags;
+}
+
+size_t SurfacePlotter::getNumX(void) {
+    return this->numX;
+}
+
+size_t SurfacePlotter::getNumY(void) {
+    return this->numY;
 }
 
 float SurfacePlotter::getZMin(void) {
@@ -151,20 +921,123 @@ float SurfacePlotter::getZRange(void) {
     return this->zMax - this->zMin;
 }
 
+size_t SurfacePlotter::getNumInvalid(void) {
+    return this->numInvalid;
+}
+
+void SurfacePlotter::setVertexFormat(VertexFormat format) {
+    if (format == this->vertexFormat)
+        return;
+
+    this->vertexFormat = format;
+    invalidateVertices();
+}
+
+VertexFormat SurfacePlotter::getVertexFormat(void) {
+    return this->vertexFormat;
+}
+
+void SurfacePlotter::setTopology(Topology topology) {
+    if (topology == this->topology)
+        return;
+
+    // the same segments, masked as before
+    this->topology = topology;
+    generateIndices(this->indicesMasked ? this->indexValidity.data() : NULL);
+}
+
+Topology SurfacePlotter::getTopology(void) {
+    return this->topology;
+}
+
+void SurfacePlotter::setNormals(bool normals) {
+    if (normals == this->normals)
+        return;
+
+    // the vertex data changes size, and a cached field is rebuilt with its slopes
+    this->normals = normals;
+    if (normals && !this->fieldHasSlopes)
+        this->fieldCurrent = false;
+    invalidateVertices();
+}
+
+bool SurfacePlotter::getNormals(void) {
+    return this->normals;
+}
+
+bool SurfacePlotter::hasNormals(void) {
+    return this->normalsReady;
+}
+
+bool SurfacePlotter::hasNormalData(void) {
+    return this->normals && !this->nativeFunction;
+}
+
+size_t SurfacePlotter::getNormalOffset(void) {
+    return getVertexDataSize() - sizeof(uint32_t) * this->numX * this->numY;
+}
+
+uint32_t* SurfacePlotter::getNormalTarget(void) {
+    char* data = static_cast<char*>(const_cast<void*>(getVertexData()));
+    return reinterpret_cast<uint32_t*>(data + getNormalOffset());
+}
+
+glm::vec2 SurfacePlotter::getGridOrigin(void) {
+    return glm::vec2(this->xMin, this->yMin);
+}
+
+float SurfacePlotter::getGridInterval(void) {
+    return this->gridInterval;
+}
+
+const void* SurfacePlotter::getVertexData(void) {
+    if (this->vertexTarget)
+        return this->vertexTarget;
+    if (this->vertexFormat == VERTEX_FORMAT_HALF_HEIGHT)
+        return this->halfVertices.data();
+    return this->vertices.data();
+}
+
+size_t SurfacePlotter::getVertexDataSize(void) {
+    size_t vertexSize = sizeof(uint16_t);
+    if (this->vertexFormat == VERTEX_FORMAT_FULL)
+        vertexSize = 3 * sizeof(float);
+    else if (this->vertexFormat == VERTEX_FORMAT_HEIGHT)
+        vertexSize = sizeof(float);
+
+    // normals start on a 4 byte boundary after the vertices
+    size_t size = vertexSize * this->numX * this->numY;
+    if (hasNormalData())
+        size = (size + 3) / 4 * 4 + sizeof(uint32_t) * this->numX * this->numY;
+    return size;
+}
+
+void SurfacePlotter::setVertexTarget(void* target) {
+    if (target == this->vertexTarget)
+        return;
+
+    this->vertexTarget = target;
+    invalidateVertices();
+}
+
 float* SurfacePlotter::getVertices(void) {
-    return this->vertices;
+    return this->vertices.data();
 }
 
 uint SurfacePlotter::getNumElements(void) {
-    return this->numElements;
+    return std::min(this->vertices.size(), (this->vertexFormat == VERTEX_FORMAT_FULL ? 3 : 1) * this->numX * this->numY);
 }
 
 uint* SurfacePlotter::getIndices(void) {
-    return this->indices;
+    return this->indices.data();
 }
 
 uint SurfacePlotter::getNumIndices(void) {
-    return this->numIndices;
+    return this->indices.size();
+}
+
+uint SurfacePlotter::getNumLineIndices(void) {
+    return this->numLineIndices;
 }
 
 float* SurfacePlotter::getCubeVertices(void) {
@@ -0,0 +1,144 @@
+#include "../include/SurfaceProducer.h"
+
+#include <cstring>
+
+#define FRESH 4 // set in middle while it holds a frame the render thread has not taken
+
+SurfaceFrame::SurfaceFrame() :
+    id(0), time(0.0f), zMin(0.0f), zMax(0.0f), format(VERTEX_FORMAT_FULL), vertexData(NULL), vertexDataSize(0),
+    hasNormals(false), normalOffset(0), cubeVertices(), indices(NULL), numIndices(0), numLineIndices(0), topology(TOPOLOGY_LINES), numInvalid(0), dirtyFlags(0), gpuVertices(false), generateTime(0.0) {}
+
+void SurfaceFrame::capture(SurfacePlotter& surfacePlotter, uint id, uint droppedFlags) {
+    this->id = id;
+    this->zMin = surfacePlotter.getZMin();
+    this->zMax = surfacePlotter.getZMax();
+    this->format = surfacePlotter.getVertexFormat();
+    this->vertexData = surfacePlotter.getVertexData();
+    this->vertexDataSize = surfacePlotter.getVertexDataSize();
+    this->hasNormals = surfacePlotter.hasNormals();
+    this->normalOffset = this->hasNormals ? surfacePlotter.getNormalOffset() : 0;
+    memcpy(this->cubeVertices, surfacePlotter.getCubeVertices(), sizeof(this->cubeVertices));
+    this->numIndices = surfacePlotter.getNumIndices();
+    this->numLineIndices = surfacePlotter.getNumLineIndices();
+    this->topology = surfacePlotter.getTopology();
+    this->numInvalid = surfacePlotter.getNumInvalid();
+
+    this->dirtyFlags = surfacePlotter.getDirtyFlags() | droppedFlags;
+
+    // copied, the surface plotter may rebuild its indices while the frame is drawn, the current ones
+    // also stand in for the indices of a dropped frame
+    if (this->dirtyFlags & DIRTY_INDICES) {
+        this->indexStorage.resize(this->numIndices);
+        memcpy(this->indexStorage.data(), surfacePlotter.getIndices(), this->numIndices * sizeof(uint));
+        this->indices = this->indexStorage.data();
+    }
+    this->gpuVertices = false;
+    surfacePlotter.clearDirtyFlags(this->dirtyFlags);
+}
+
+SurfaceProducer::SurfaceProducer(SurfacePlotter& surfacePlotter) :
+    surfacePlotter(surfacePlotter), clock(NULL), notify(NULL), running(false), vertexFormat(VERTEX_FORMAT_FULL), topology(TOPOLOGY_LINES),
+    normals(false), numFrames(0), droppedFlags(0), back(0), front(1), middle(2) {}
+
+SurfaceProducer::~SurfaceProducer() {
+    stop();
+}
+
+void SurfaceProducer::start(double (*clock)(void), void (*notify)(void)) {
+    if (this->running)
+        return;
+
+    this->clock = clock;
+    this->notify = notify;
+    this->vertexFormat = this->surfacePlotter.getVertexFormat();
+    this->topology = this->surfacePlotter.getTopology();
+    this->normals = this->surfacePlotter.getNormals();
+
+    // the render thread has a frame to draw from the start
+    generate(this->frames[this->front]);
+
+    this->running = true;
+    this->thread = std::thread(&SurfaceProducer::producerLoop, this);
+}
+
+void SurfaceProducer::stop(void) {
+    if (!this->running)
+        return;
+
+    this->running = false;
+    this->settingsChanged.notify_one();
+    this->thread.join();
+
+    // the surface plotter writes to its own storage again
+    this->surfacePlotter.setVertexTarget(NULL);
+}
+
+bool SurfaceProducer::isRunning(void) {
+    return this->running;
+}
+
+void SurfaceProducer::setVertexFormat(VertexFormat format) {
+    this->vertexFormat = format;
+    this->settingsChanged.notify_one();
+}
+
+void SurfaceProducer::setTopology(Topology topology) {
+    this->topology = topology;
+    this->settingsChanged.notify_one();
+}
+
+void SurfaceProducer::setNormals(bool normals) {
+    this->normals = normals;
+    this->settingsChanged.notify_one();
+}
+
+void SurfaceProducer::generate(SurfaceFrame& frame) {
+    this->surfacePlotter.setVertexFormat((VertexFormat) this->vertexFormat.load());
+    this->surfacePlotter.setTopology((Topology) this->topology.load());
+    this->surfacePlotter.setNormals(this->normals);
+
+    // frame storage is reused and only grows with the vertex data
+    frame.storage.resize(this->surfacePlotter.getVertexDataSize());
+    this->surfacePlotter.setVertexTarget(frame.storage.data());
+
+    double start = this->clock();
+    frame.time = start;
+    this->surfacePlotter.generateSurfacePlot(frame.time);
+    frame.capture(this->surfacePlotter, ++this->numFrames, this->droppedFlags);
+    this->droppedFlags = 0;
+    frame.generateTime = this->clock() - start;
+}
+
+void SurfaceProducer::producerLoop(void) {
+    while (this->running) {
+
+        // a static surface only changes with the vertex format, topology and normals, there is nothing to generate until then
+        if (!this->surfacePlotter.dependsOnTime()) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            while (this->running && this->vertexFormat == this->surfacePlotter.getVertexFormat() &&
+                   this->topology == this->surfacePlotter.getTopology() && this->normals == this->surfacePlotter.getNormals())
+                this->settingsChanged.wait_for(lock, std::chrono::milliseconds(PRODUCER_IDLE_TIMEOUT));
+            if (!this->running)
+                break;
+        }
+
+        generate(this->frames[this->back]);
+
+        // publish, a frame the render thread has not taken is replaced and its changes go into the next one
+        uint previous = this->middle.exchange(this->back | FRESH, std::memory_order_acq_rel);
+        this->back = previous & ~FRESH;
+        if (previous & FRESH)
+            this->droppedFlags = this->frames[this->back].dirtyFlags;
+        if (this->notify)
+            this->notify();
+    }
+}
+
+const SurfaceFrame& SurfaceProducer::acquireFrame(void) {
+
+    // take the published frame if it is newer than the one being drawn
+    if (this->middle.load(std::memory_order_relaxed) & FRESH) {
+        this->front = this->middle.exchange(this->front, std::memory_order_acq_rel) & ~FRESH;
+    }
+    return this->frames[this->front];
+}
@@ -0,0 +1,99 @@
+#include "../include/ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint numThreads) :
+    invoke(NULL), context(NULL), numTasks(0), nextTask(0), activeWorkers(0), generation(0), stopping(false) {
+
+    setNumThreads(numThreads);
+}
+
+ThreadPool::~ThreadPool() {
+    stopWorkers();
+}
+
+void ThreadPool::setNumThreads(uint numThreads) {
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    if (numThreads == getNumThreads())
+        return;
+
+    stopWorkers();
+
+    // the calling thread counts as one of the threads
+    this->stopping = false;
+    for (uint i = 1; i < numThreads; ++i)
+        this->workers.emplace_back(&ThreadPool::workerLoop, this, this->generation);
+}
+
+uint ThreadPool::getNumThreads(void) const {
+    return this->workers.size() + 1;
+}
+
+void ThreadPool::run(uint numTasks, void (*invoke)(void* context, uint task), void* context) {
+
+    // nothing to share
+    if (this->workers.empty() || numTasks <= 1) {
+        for (uint task = 0; task < numTasks; ++task)
+            invoke(context, task);
+        return;
+    }
+
+    // publish job
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->invoke = invoke;
+        this->context = context;
+        this->numTasks = numTasks;
+        this->nextTask = 0;
+        this->activeWorkers = this->workers.size();
+        this->generation++;
+    }
+    this->workAvailable.notify_all();
+
+    runTasks();
+
+    // wait for workers to finish their last task
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->workDone.wait(lock, [this] { return this->activeWorkers == 0; });
+}
+
+void ThreadPool::runTasks(void) {
+    for (uint task = this->nextTask++; task < this->numTasks; task = this->nextTask++)
+        this->invoke(this->context, task);
+}
+
+void ThreadPool::workerLoop(uint seen) {
+    while (true) {
+
+        // sleep until a new job or shutdown
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->workAvailable.wait(lock, [this, seen] { return this->stopping || this->generation != seen; });
+            if (this->stopping)
+                return;
+            seen = this->generation;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (--this->activeWorkers == 0)
+                this->workDone.notify_one();
+        }
+    }
+}
+
+void ThreadPool::stopWorkers(void) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->workAvailable.notify_all();
+
+    for (std::thread& worker : this->workers)
+        worker.join();
+    this->workers.clear();
+}
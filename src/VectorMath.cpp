@@ -0,0 +1,259 @@
+#include "../include/VectorMath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// SCALAR FALLBACK
+
+#define SCALAR_UNARY(name, expr) \
+    static void name(float* dst, const float* a, const float*, size_t n) { \
+        for (size_t i = 0; i < n; ++i) { float u = a[i]; dst[i] = (expr); } \
+    }
+
+#define SCALAR_BINARY(name, expr) \
+    static void name(float* dst, const float* a, const float* b, size_t n) { \
+        for (size_t i = 0; i < n; ++i) { float u = a[i], v = b[i]; dst[i] = (expr); } \
+    }
+
+SCALAR_BINARY(scalarAdd, u + v)
+SCALAR_BINARY(scalarSub, u - v)
+SCALAR_BINARY(scalarMul, u * v)
+SCALAR_BINARY(scalarDiv, u / v)
+SCALAR_BINARY(scalarPow, std::pow(u, v))
+SCALAR_UNARY(scalarNeg, -u)
+SCALAR_UNARY(scalarAbs, std::fabs(u))
+SCALAR_UNARY(scalarSqrt, std::sqrt(u))
+SCALAR_UNARY(scalarExp, std::exp(u))
+SCALAR_UNARY(scalarLog, std::log(u))
+SCALAR_UNARY(scalarSin, std::sin(u))
+SCALAR_UNARY(scalarCos, std::cos(u))
+SCALAR_UNARY(scalarTan, std::tan(u))
+SCALAR_UNARY(scalarAsin, std::asin(u))
+SCALAR_UNARY(scalarAcos, std::acos(u))
+SCALAR_UNARY(scalarAtan, std::atan(u))
+SCALAR_UNARY(scalarSinh, std::sinh(u))
+SCALAR_UNARY(scalarCosh, std::cosh(u))
+SCALAR_UNARY(scalarTanh, std::tanh(u))
+
+// HALF FLOAT
+
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    // NaN stays NaN, infinity and overflow become infinity
+    if (magnitude > 0x7f800000)
+        return sign | 0x7e00;
+    if (magnitude >= 0x477ff000)
+        return sign | 0x7c00;
+
+    // subnormal halves, the float is scaled so its integer bits are the half mantissa
+    if (magnitude < 0x38800000) {
+        float scaled;
+        uint32_t absBits = magnitude;
+        memcpy(&scaled, &absBits, sizeof(scaled));
+        return sign | (uint16_t)lrintf(scaled * 16777216.0f); // 2^24
+    }
+
+    // normal halves, rebias the exponent and round the mantissa to nearest even
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t remainder = magnitude & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        half++;
+    return sign | (uint16_t)half;
+}
+
+static void scalarToHalf(const float* src, uint16_t* dst, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = floatToHalf(src[i]);
+}
+
+// Z RANGE
+
+static size_t scalarRange(const float* z, uint8_t* valid, size_t n, float* zMin, float* zMax) {
+    float lo = *zMin, hi = *zMax;
+    size_t numInvalid = 0;
+    for (size_t i = 0; i < n; ++i) {
+        bool finite = std::fabs(z[i]) < INFINITY; // false for NaN too
+        valid[i] = finite;
+        numInvalid += !finite;
+        lo = finite ? std::min(lo, z[i]) : lo;
+        hi = finite ? std::max(hi, z[i]) : hi;
+    }
+    *zMin = lo;
+    *zMax = hi;
+    return numInvalid;
+}
+
+// SEPARABLE AND TIME FACTORED FUNCTIONS
+
+static void scalarBroadcastAdd(float* dst, float a, const float* b, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a + b[i];
+}
+
+static void scalarBroadcastMul(float* dst, float a, const float* b, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a * b[i];
+}
+
+static void scalarAffine(float* dst, float a, const float* src, float b, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a * src[i] + b;
+}
+
+static void scalarBlend(float* dst, const float* a, const float* b, float w, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a[i] + w * (b[i] - a[i]);
+}
+
+static float scalarMidpointError(const float* z, const float* a, const float* b, size_t n) {
+    float error = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        bool finite = std::fabs(a[i]) < INFINITY && std::fabs(b[i]) < INFINITY;
+        if (finite != (std::fabs(z[i]) < INFINITY))
+            return INFINITY;
+        if (finite)
+            error = std::max(error, std::fabs(z[i] - 0.5f * (a[i] + b[i])));
+    }
+    return error;
+}
+
+// NORMALS
+
+static void scalarNormals(const float* dzdx, const float* dzdy, float scale, uint32_t* dst, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        float gx = -scale * dzdx[i];
+        float gy = -scale * dzdy[i];
+        float inverse = 1.0f / (std::fabs(gx) + std::fabs(gy) + 1.0f);
+        float px = gx * inverse;
+        float py = gy * inverse;
+        if (px != px || py != py) {
+            px = 0.0f;
+            py = 0.0f;
+        }
+
+        // rounded to nearest, |p| <= 1 so the products fit
+        int32_t x = (int32_t)(px * 32767.0f + std::copysign(0.5f, px));
+        int32_t y = (int32_t)(py * 32767.0f + std::copysign(0.5f, py));
+        dst[i] = ((uint32_t) x & 0xffff) | ((uint32_t) y << 16);
+    }
+}
+
+// RADIAL PROFILE
+
+static void scalarRadial(const float* profile, int last, float step, float x, const float* ys, float* z, size_t n) {
+    float invStep = 1.0f / step;
+    for (size_t i = 0; i < n; ++i) {
+        float u = std::sqrt(x * x + ys[i] * ys[i]) * invStep;
+        int k = std::min((int) u, last);
+        z[i] = profile[k] + (u - k) * (profile[k + 1] - profile[k]);
+    }
+}
+
+static VectorMath createScalarVectorMath(void) {
+    VectorMath vm;
+    memset(&vm, 0, sizeof(vm));
+    vm.name = "scalar";
+    vm.ops[OP_ADD] = scalarAdd;
+    vm.ops[OP_SUB] = scalarSub;
+    vm.ops[OP_MUL] = scalarMul;
+    vm.ops[OP_DIV] = scalarDiv;
+    vm.ops[OP_POW] = scalarPow;
+    vm.ops[OP_NEG] = scalarNeg;
+    vm.ops[OP_ABS] = scalarAbs;
+    vm.ops[OP_SQRT] = scalarSqrt;
+    vm.ops[OP_EXP] = scalarExp;
+    vm.ops[OP_LOG] = scalarLog;
+    vm.ops[OP_SIN] = scalarSin;
+    vm.ops[OP_COS] = scalarCos;
+    vm.ops[OP_TAN] = scalarTan;
+    vm.ops[OP_ASIN] = scalarAsin;
+    vm.ops[OP_ACOS] = scalarAcos;
+    vm.ops[OP_ATAN] = scalarAtan;
+    vm.ops[OP_SINH] = scalarSinh;
+    vm.ops[OP_COSH] = scalarCosh;
+    vm.ops[OP_TANH] = scalarTanh;
+    vm.toHalf = scalarToHalf;
+    vm.range = scalarRange;
+    vm.radial = scalarRadial;
+    vm.broadcastAdd = scalarBroadcastAdd;
+    vm.broadcastMul = scalarBroadcastMul;
+    vm.affine = scalarAffine;
+    vm.blend = scalarBlend;
+    vm.midpointError = scalarMidpointError;
+    vm.normals = scalarNormals;
+    return vm;
+}
+
+const VectorMath* getScalarVectorMath(void) {
+    static const VectorMath vm = createScalarVectorMath();
+    return &vm;
+}
+
+// RUNTIME DISPATCH
+
+static const VectorMath* selectVectorMath(void) {
+    const VectorMath* best = getScalarVectorMath();
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    const char* forced = getenv("SURFACE_PLOTTER_ISA");
+    bool allowSSE4 = !forced || strcmp(forced, "scalar") != 0;
+    bool allowAVX2 = !forced || strcmp(forced, "avx2") == 0;
+
+    if (allowSSE4 && getSSE4VectorMath() && __builtin_cpu_supports("sse4.1"))
+        best = getSSE4VectorMath();
+    if (allowAVX2 && getAVX2VectorMath() && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+        && __builtin_cpu_supports("f16c"))
+        best = getAVX2VectorMath();
+#endif
+
+    return best;
+}
+
+const VectorMath& getVectorMath(void) {
+    static const VectorMath* vm = selectVectorMath();
+    return *vm;
+}
+
+void convertToHalf(const float* src, uint16_t* dst, size_t n) {
+    getVectorMath().toHalf(src, dst, n);
+}
+
+size_t accumulateRange(const float* z, uint8_t* valid, size_t n, float* zMin, float* zMax) {
+    return getVectorMath().range(z, valid, n, zMin, zMax);
+}
+
+void broadcastAdd(float* dst, float a, const float* b, size_t n) {
+    getVectorMath().broadcastAdd(dst, a, b, n);
+}
+
+void broadcastMul(float* dst, float a, const float* b, size_t n) {
+    getVectorMath().broadcastMul(dst, a, b, n);
+}
+
+void scaleOffset(float* dst, float a, const float* src, float b, size_t n) {
+    getVectorMath().affine(dst, a, src, b, n);
+}
+
+void blend(float* dst, const float* a, const float* b, float w, size_t n) {
+    getVectorMath().blend(dst, a, b, w, n);
+}
+
+float midpointError(const float* z, const float* a, const float* b, size_t n) {
+    return getVectorMath().midpointError(z, a, b, n);
+}
+
+void encodeNormals(const float* dzdx, const float* dzdy, float scale, uint32_t* dst, size_t n) {
+    getVectorMath().normals(dzdx, dzdy, scale, dst, n);
+}
+
+void interpolateRadial(const float* profile, int last, float step, float x, const float* ys, float* z, size_t n) {
+    getVectorMath().radial(profile, last, step, x, ys, z, n);
+}
@@ -0,0 +1,96 @@
+#include "../include/VectorMath.h"
+
+// compiled with -mavx2 -mfma -mf16c, see CMakeLists.txt
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+
+#include <immintrin.h>
+#include "../include/VectorMathKernels.h"
+
+namespace {
+
+struct AVX2 {
+    typedef __m256 F;
+    typedef __m256i I;
+    static const int WIDTH = 8;
+
+    static inline F load(const float* p) { return _mm256_load_ps(p); }
+    static inline F loadu(const float* p) { return _mm256_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm256_store_ps(p, a); }
+    static inline void storeu(float* p, F a) { _mm256_storeu_ps(p, a); }
+    static inline F set1(float a) { return _mm256_set1_ps(a); }
+
+    static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static inline F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static inline F fmadd(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }
+    static inline F sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static inline F min(F a, F b) { return _mm256_min_ps(a, b); }
+    static inline F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static inline F floor(F a) { return _mm256_floor_ps(a); }
+
+    static inline F and_(F a, F b) { return _mm256_and_ps(a, b); }
+    static inline F or_(F a, F b) { return _mm256_or_ps(a, b); }
+    static inline F xor_(F a, F b) { return _mm256_xor_ps(a, b); }
+    static inline F andnot(F a, F b) { return _mm256_andnot_ps(a, b); }
+
+    static inline F cmpeq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static inline F cmpneq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+    static inline F cmplt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static inline F cmpgt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static inline F select(F mask, F a, F b) { return _mm256_blendv_ps(b, a, mask); }
+    static inline bool any(F mask) { return _mm256_movemask_ps(mask) != 0; }
+    static inline int movemask(F mask) { return _mm256_movemask_ps(mask); }
+
+    static inline I iset1(int a) { return _mm256_set1_epi32(a); }
+    static inline I iadd(I a, I b) { return _mm256_add_epi32(a, b); }
+    static inline I isub(I a, I b) { return _mm256_sub_epi32(a, b); }
+    static inline I iand(I a, I b) { return _mm256_and_si256(a, b); }
+    static inline I iandnot(I a, I b) { return _mm256_andnot_si256(a, b); }
+    static inline I icmpeq(I a, I b) { return _mm256_cmpeq_epi32(a, b); }
+    static inline I imin(I a, I b) { return _mm256_min_epi32(a, b); }
+    static inline I slli(I a, int n) { return _mm256_slli_epi32(a, n); }
+    static inline I srli(I a, int n) { return _mm256_srli_epi32(a, n); }
+
+    static inline I cvtt(F a) { return _mm256_cvttps_epi32(a); }
+    static inline F cvtif(I a) { return _mm256_cvtepi32_ps(a); }
+    static inline I castfi(F a) { return _mm256_castps_si256(a); }
+    static inline F gather(const float* p, I index) { return _mm256_i32gather_ps(p, index, 4); }
+    static inline F castif(I a) { return _mm256_castsi256_ps(a); }
+};
+
+}
+
+// hardware conversion, the tail is padded like the arithmetic kernels
+static void toHalf(const float* src, uint16_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+
+    if (i < n) {
+        alignas(32) float tail[8] = {0};
+        alignas(16) uint16_t halves[8];
+        memcpy(tail, src + i, (n - i) * sizeof(float));
+        _mm_store_si128((__m128i*)halves, _mm256_cvtps_ph(_mm256_load_ps(tail), _MM_FROUND_TO_NEAREST_INT));
+        memcpy(dst + i, halves, (n - i) * sizeof(uint16_t));
+    }
+}
+
+static VectorMath createAVX2VectorMath(void) {
+    VectorMath vm = VectorKernels<AVX2>::create("avx2");
+    vm.toHalf = toHalf;
+    return vm;
+}
+
+const VectorMath* getAVX2VectorMath(void) {
+    static const VectorMath vm = createAVX2VectorMath();
+    return &vm;
+}
+
+#else
+
+const VectorMath* getAVX2VectorMath(void) {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include "../include/VectorMath.h"
+
+// compiled with -msse4.1, see CMakeLists.txt
+#if defined(__SSE4_1__)
+
+#include <smmintrin.h>
+#include "../include/VectorMathKernels.h"
+
+namespace {
+
+struct SSE4 {
+    typedef __m128 F;
+    typedef __m128i I;
+    static const int WIDTH = 4;
+
+    static inline F load(const float* p) { return _mm_load_ps(p); }
+    static inline F loadu(const float* p) { return _mm_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm_store_ps(p, a); }
+    static inline void storeu(float* p, F a) { _mm_storeu_ps(p, a); }
+    static inline F set1(float a) { return _mm_set1_ps(a); }
+
+    static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static inline F div(F a, F b) { return _mm_div_ps(a, b); }
+    static inline F fmadd(F a, F b, F c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static inline F sqrt(F a) { return _mm_sqrt_ps(a); }
+    static inline F min(F a, F b) { return _mm_min_ps(a, b); }
+    static inline F max(F a, F b) { return _mm_max_ps(a, b); }
+    static inline F floor(F a) { return _mm_floor_ps(a); }
+
+    static inline F and_(F a, F b) { return _mm_and_ps(a, b); }
+    static inline F or_(F a, F b) { return _mm_or_ps(a, b); }
+    static inline F xor_(F a, F b) { return _mm_xor_ps(a, b); }
+    static inline F andnot(F a, F b) { return _mm_andnot_ps(a, b); }
+
+    static inline F cmpeq(F a, F b) { return _mm_cmpeq_ps(a, b); }
+    static inline F cmpneq(F a, F b) { return _mm_cmpneq_ps(a, b); }
+    static inline F cmplt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static inline F cmpgt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+    static inline F select(F mask, F a, F b) { return _mm_blendv_ps(b, a, mask); }
+    static inline bool any(F mask) { return _mm_movemask_ps(mask) != 0; }
+    static inline int movemask(F mask) { return _mm_movemask_ps(mask); }
+
+    static inline I iset1(int a) { return _mm_set1_epi32(a); }
+    static inline I iadd(I a, I b) { return _mm_add_epi32(a, b); }
+    static inline I isub(I a, I b) { return _mm_sub_epi32(a, b); }
+    static inline I iand(I a, I b) { return _mm_and_si128(a, b); }
+    static inline I iandnot(I a, I b) { return _mm_andnot_si128(a, b); }
+    static inline I icmpeq(I a, I b) { return _mm_cmpeq_epi32(a, b); }
+    static inline I imin(I a, I b) { return _mm_min_epi32(a, b); }
+    static inline I slli(I a, int n) { return _mm_slli_epi32(a, n); }
+    static inline I srli(I a, int n) { return _mm_srli_epi32(a, n); }
+
+    static inline I cvtt(F a) { return _mm_cvttps_epi32(a); }
+    static inline F cvtif(I a) { return _mm_cvtepi32_ps(a); }
+    static inline I castfi(F a) { return _mm_castps_si128(a); }
+
+    // no gather instruction before AVX2
+    static inline F gather(const float* p, I index) {
+        return _mm_set_ps(p[_mm_extract_epi32(index, 3)], p[_mm_extract_epi32(index, 2)],
+                          p[_mm_extract_epi32(index, 1)], p[_mm_cvtsi128_si32(index)]);
+    }
+    static inline F castif(I a) { return _mm_castsi128_ps(a); }
+};
+
+}
+
+const VectorMath* getSSE4VectorMath(void) {
+    static const VectorMath vm = VectorKernels<SSE4>::create("sse4");
+    return &vm;
+}
+
+#else
+
+const VectorMath* getSSE4VectorMath(void) {
+    return NULL;
+}
+
+#endif
@@ -1,12 +1,20 @@
 #include "../include/GLProgram.h"
+#include "../include/ImageWriter.h"
+
+#include <cstdlib>
+#include <sstream>
 
 #define WINDOW_WIDTH 1600
 #define WINDOW_HEIGHT 1200
+#define HEADLESS_FRAMES 60      // frames rendered without --times
+#define HEADLESS_FRAME_RATE 30  // frames per unit of t without --times
 
 // shader source code paths
 const char* vertexShaderPath = "shaders/vertexShader.vs";
+const char* heightVertexShaderPath = "shaders/heightVertexShader.vs";
 const char* fragmentShaderPath = "shaders/fragmentShader.fs";
 const char* whiteFragmentShaderPath = "shaders/whiteFragmentShader.fs";
+const char* computeShaderPath = "shaders/computeShader.cs";
 
 // declare static members for use in callback functions
 int GLProgram::windowWidth = WINDOW_WIDTH;
@@ -16,11 +24,218 @@ bool GLProgram::mousePressed = false;
 double GLProgram::prevMouseX, GLProgram::prevMouseY;
 glm::mat4 GLProgram::modelMatrix = glm::mat4(1.0f);
 
-int main() {
+// time values as a comma separated list, "0,0.5,2", or a range start:end:step with end included, "0:6.28:0.1"
+static bool parseTimes(const std::string& arg, std::vector<float>& times) {
+    std::istringstream stream(arg);
+    float start, end, step;
+    char colon1, colon2;
+    if (stream >> start >> colon1 >> end >> colon2 >> step && colon1 == ':' && colon2 == ':' && stream.eof()) {
+        if (step <= 0.0f || end < start)
+            return false;
+
+        // counted rather than accumulated so the last value does not drift
+        int numTimes = (int)((end - start) / step + 1e-4f) + 1;
+        for (int i = 0; i < numTimes; ++i)
+            times.push_back(start + i * step);
+        return true;
+    }
+
+    stream.clear();
+    stream.str(arg);
+    std::string value;
+    while (std::getline(stream, value, ',')) {
+        char* end;
+        times.push_back(strtof(value.c_str(), &end));
+        if (value.empty() || *end != '\0')
+            return false;
+    }
+    return !times.empty();
+}
+
+// usage: 3DSurfacePlotter [--threads N] [--vertex-format full|float|half] [--style wireframe|filled|overlay|grid] [--line-width W]
+//                         [--no-streaming] [--sync] [--compute | --compute-check] [--exact] [--period P] [--cache-budget MB] [--timing]
+//                         [--on-demand] [--interpolate] [--capture PATTERN] [--headless [--size WxH] [--times LIST] [--output PATTERN]]
+//                         ["f(x, y, t)"]
+int main(int argc, char** argv) {
     GLProgram program;
-    program.init(vertexShaderPath, fragmentShaderPath, whiteFragmentShaderPath);
+    bool headless = false;
+    std::vector<float> times;
+    std::string outputPattern = "frame_%04d.png";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        // worker threads used to generate the surface, 0 for one per hardware thread
+        if (arg == "--threads" && i + 1 < argc) {
+            program.setNumThreads(atoi(argv[++i]));
+            continue;
+        }
+
+        // per-vertex data uploaded each frame: xyz floats, z float, or z half float
+        if (arg == "--vertex-format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "full")
+                program.setVertexFormat(VERTEX_FORMAT_FULL);
+            else if (format == "float")
+                program.setVertexFormat(VERTEX_FORMAT_HEIGHT);
+            else if (format == "half")
+                program.setVertexFormat(VERTEX_FORMAT_HALF_HEIGHT);
+            else {
+                std::cout << "ERROR: UNKNOWN VERTEX FORMAT: " << format << std::endl;
+                return -1;
+            }
+            continue;
+        }
+
+        // wireframe, filled triangles, or filled triangles with the wireframe or with grid lines over them
+        if (arg == "--style" && i + 1 < argc) {
+            std::string style = argv[++i];
+            if (style == "wireframe")
+                program.setSurfaceStyle(STYLE_WIREFRAME);
+            else if (style == "filled")
+                program.setSurfaceStyle(STYLE_FILLED);
+            else if (style == "overlay")
+                program.setSurfaceStyle(STYLE_FILLED_WIREFRAME);
+            else if (style == "grid")
+                program.setSurfaceStyle(STYLE_FILLED_GRID);
+            else {
+                std::cout << "ERROR: UNKNOWN SURFACE STYLE: " << style << std::endl;
+                return -1;
+            }
+            continue;
+        }
+
+        // pixels, of the grid lines of the grid style
+        if (arg == "--line-width" && i + 1 < argc) {
+            program.setGridLineWidth(atof(argv[++i]));
+            continue;
+        }
+
+        // re-specify the vertex buffer with glBufferData every frame instead of streaming into mapped memory
+        if (arg == "--no-streaming") {
+            program.setStreaming(false);
+            continue;
+        }
+
+        // generate the surface in the render loop instead of on a producer thread
+        if (arg == "--sync") {
+            program.setAsync(false);
+            continue;
+        }
+
+        // evaluate the function at every grid point even when its symmetry allows fewer evaluations
+        if (arg == "--exact") {
+            program.setExact(true);
+            continue;
+        }
+
+        // period of the animation cache, found in parsed functions when not given, and its memory budget
+        if (arg == "--period" && i + 1 < argc) {
+            program.setPeriod(atof(argv[++i]));
+            continue;
+        }
+        if (arg == "--cache-budget" && i + 1 < argc) {
+            program.setCacheBudget((size_t) atoi(argv[++i]) << 20);
+            continue;
+        }
+
+        // print where the frame time goes
+        if (arg == "--timing") {
+            program.setTiming(true);
+            continue;
+        }
+
+        // blend on the GPU between frames from the producer thread, so slow functions move smoothly
+        if (arg == "--interpolate") {
+            program.setInterpolate(true);
+            continue;
+        }
+
+        // redraw a static surface only on input, an idle window then uses no CPU
+        if (arg == "--on-demand") {
+            program.setOnDemand(true);
+            continue;
+        }
+
+        // evaluate the function in a compute shader, optionally checking every frame against the CPU
+        if (arg == "--compute" || arg == "--compute-check") {
+            program.setCompute(true);
+            program.setComputeCheck(arg == "--compute-check");
+            continue;
+        }
+
+        // render offscreen through EGL and write the frames to disk instead of opening a window
+        if (arg == "--headless") {
+            headless = true;
+            continue;
+        }
+
+        // offscreen frame size
+        if (arg == "--size" && i + 1 < argc) {
+            int width, height;
+            char separator;
+            std::istringstream size(argv[++i]);
+            if (!(size >> width >> separator >> height) || separator != 'x' || width <= 0 || height <= 0) {
+                std::cout << "ERROR: INVALID SIZE: " << argv[i] << std::endl;
+                return -1;
+            }
+            GLProgram::windowWidth = width;
+            GLProgram::windowHeight = height;
+            continue;
+        }
+
+        // values of t to render
+        if (arg == "--times" && i + 1 < argc) {
+            times.clear();
+            if (!parseTimes(argv[++i], times)) {
+                std::cout << "ERROR: INVALID TIMES: " << argv[i] << std::endl;
+                return -1;
+            }
+            continue;
+        }
+
+        // frame file names, %d is the frame number, .ppm writes raw frames and anything else PNG,
+        // or a single .y4m video
+        if (arg == "--output" && i + 1 < argc) {
+            std::string path;
+            outputPattern = argv[++i];
+            if (!hasExtension(outputPattern, ".y4m") && !formatFramePath(outputPattern, 0, path)) {
+                std::cout << "ERROR: OUTPUT PATTERN NEEDS ONE %d FIELD: " << outputPattern << std::endl;
+                return -1;
+            }
+            continue;
+        }
+
+        // record the window from the first frame, same patterns as --output
+        if (arg == "--capture" && i + 1 < argc) {
+            if (!program.setCapture(argv[++i])) {
+                std::cout << "ERROR: CAPTURE PATTERN NEEDS ONE %d FIELD: " << argv[i] << std::endl;
+                return -1;
+            }
+            continue;
+        }
+
+        // function of x, y and t, e.g. "sin(x^2 + y^2)"
+        std::string error;
+        if (!program.setFunction(arg, &error)) {
+            std::cout << "ERROR: FAILED TO PARSE FUNCTION: " << error << std::endl;
+            return -1;
+        }
+    }
+
+    if (times.empty()) {
+        for (int i = 0; i < HEADLESS_FRAMES; ++i)
+            times.push_back((float) i / HEADLESS_FRAME_RATE);
+    }
+
+    program.setHeadless(headless);
+    program.init(vertexShaderPath, heightVertexShaderPath, fragmentShaderPath, whiteFragmentShaderPath, computeShaderPath);
     program.setClearColor(0.05f, 0.18f, 0.25f, 1.0f);
-    program.run();
+    bool success;
+    if (headless)
+        success = program.renderFrames(times, outputPattern, HEADLESS_FRAME_RATE);
+    else
+        success = program.run();
     program.cleanup();
-    return 0;
+    return success ? 0 : -1;
 }
\ No newline at end of file